@@ -40,4 +40,9 @@ endef
 
 installed_include_subdirs = mpgc
 
+# bench and scalebench share their workloads through the header-only
+# tools/common/workloads.h.
+bench_cpp_extra_includes = -I$(project_dir)/tools/common
+scalebench_cpp_extra_includes = -I$(project_dir)/tools/common
+
 include ../build.mk
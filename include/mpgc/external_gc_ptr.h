@@ -37,11 +37,15 @@
 #include <unordered_map>
 #include <memory>
 #include <array>
-#include <mutex>
-#include <stack>
+#include <vector>
+#include <algorithm>
 #include <cstdlib>
+#include <cstdint>
 #include <atomic>
+#include <mutex>
+#include <new>
 #include <ostream>
+#include <iostream>
 #include "mpgc/gc_ptr.h"
 
 namespace mpgc {
@@ -56,100 +60,349 @@ namespace mpgc {
       constexpr static ptrint global_cache_size = 1<<20;
       constexpr static ptrint local_cache_size = 1<<12;
 
+      /*
+       * Maps target addresses to the inbound table slots that hold them,
+       * so that threads creating external_gc_ptrs to the same object share
+       * a slot.  It's only a hint: an entry names a slot, and the caller
+       * checks that the slot still holds the target when taking a
+       * reference to it, so entries can be overwritten, go stale, or be
+       * missing, and two slots for the same target are fine.
+       *
+       * Entries are a 32-bit tag from the address and a 32-bit slot index
+       * packed into a word, eight to a cache line.  A lookup reads one line
+       * and doesn't write anything shared unless it finds a candidate.  The
+       * line is picked by the tag alone, so the table can be rehashed from
+       * its entries.  It starts small and is replaced by one twice the size,
+       * with the entries carried over, once it's half full, up to
+       * global_cache_size entries.  (An insert that raced with the copy is
+       * redone in the new table, but an entry erased during the copy may
+       * come back stale, which a hint can afford.)
+       *
+       * Every thread publishes the table it's using in a hazard slot of its
+       * own, and a replaced table is freed once no hazard slot names it.
+       */
       class global_cache {
-        constexpr static ptrint mask = global_cache_size-1;
-
-        class entry {
-          std::atomic_flag _lock = ATOMIC_FLAG_INIT;
-          std::weak_ptr<target_base> _ptr;
-
-          class maybe_lock {
-            std::atomic_flag &_lock;
-            const bool _locked;
-          public:
-            explicit maybe_lock(std::atomic_flag &flag)
-            : _lock{flag},
-              _locked{!flag.test_and_set()}
-            {}
-            ~maybe_lock() {
-              if (_locked) {
-                _lock.clear();
+        constexpr static std::size_t line_entries = 8;
+        constexpr static std::size_t initial_lines = 1<<10;
+
+        using entry_type = std::atomic<std::uint64_t>;
+        struct alignas(64) line {
+          entry_type entries[line_entries];
+        };
+
+        struct table {
+          const std::size_t n_lines;
+          const unsigned shift;
+          std::atomic<std::size_t> used{0};
+          line * const lines;
+          // Link in the list of replaced tables waiting to be freed.
+          table *retired_next = nullptr;
+
+          // Not new[], which doesn't honor the alignment of line before C++17.
+          static line *allocate_lines(std::size_t n) {
+            void *p = nullptr;
+            if (posix_memalign(&p, alignof(line), n * sizeof(line)) != 0) {
+              throw std::bad_alloc();
+            }
+            line *l = static_cast<line*>(p);
+            for (std::size_t i = 0; i < n; i++) {
+              new (l + i) line();
+            }
+            return l;
+          }
+
+          explicit table(std::size_t n)
+            : n_lines{n}, shift{unsigned(64 - __builtin_ctzll(n))}, lines{allocate_lines(n)} {}
+          table(const table &) = delete;
+          table &operator =(const table &) = delete;
+          ~table() {
+            std::free(lines);
+          }
+
+          // The top bits of the product are the well-mixed ones.
+          line &line_for(std::uint64_t tag) {
+            std::uint64_t h = tag * 0x9E3779B97F4A7C15ULL;
+            return lines[h >> shift];
+          }
+
+          bool put(line &l, std::uint64_t v) {
+            for (entry_type &e : l.entries) {
+              std::uint64_t empty = 0;
+              if (e.load(std::memory_order_relaxed) == 0
+                  && e.compare_exchange_strong(empty, v, std::memory_order_relaxed)) {
+                used.fetch_add(1, std::memory_order_relaxed);
+                return true;
               }
             }
-            operator bool() const {
-              return _locked;
+            return false;
+          }
+        };
+
+        struct hazard {
+          std::atomic<table*> t{nullptr};
+          std::atomic<bool> in_use{true};
+          hazard *next = nullptr;
+        };
+
+        // Gives the calling thread a hazard slot for as long as it lives.
+        struct hazard_holder {
+          global_cache &cache;
+          hazard * const h;
+          explicit hazard_holder(global_cache &c) : cache(c), h(c.acquire_hazard()) {}
+          ~hazard_holder() {
+            h->t.store(nullptr, std::memory_order_release);
+            h->in_use.store(false, std::memory_order_release);
+          }
+        };
+
+        std::atomic<table*> _current{new table(initial_lines)};
+        // Hazard slots are never freed, only reused by later threads.
+        std::atomic<hazard*> _hazards{nullptr};
+        std::mutex _retired_mutex;
+        std::atomic<table*> _retired{nullptr};
+
+        constexpr static std::uint64_t tag_of(target_base *ptr) {
+          return std::uint32_t(reinterpret_cast<ptrint>(ptr) >> 3);
+        }
+        constexpr static std::uint64_t entry_for(target_base *ptr, index_type i) {
+          return (tag_of(ptr) << 32) | i;
+        }
+
+        hazard *acquire_hazard() {
+          for (hazard *h = _hazards.load(std::memory_order_acquire); h != nullptr; h = h->next) {
+            bool free = false;
+            if (!h->in_use.load(std::memory_order_relaxed)
+                && h->in_use.compare_exchange_strong(free, true, std::memory_order_acquire)) {
+              return h;
             }
-          };
-        public:
-
-          template <typename Creator>
-          std::shared_ptr<target_base> get(target_base *ptr, const Creator &creator) {
-            // It would be nice to only grab the lock when we're changing it, but
-            // reading a weak pointer isn't necessarily atomic, since there are
-            // two pointers in it.  There's a proposal for an atomic_weak_ptr class,
-            // but it's not in yet.  So we may create a spurious new one even if
-            // the lock was held by somebody reading.  Hopefully, the thread-local
-            // caches will keep this from happening too often.
-            maybe_lock ml(_lock);
-            if (!ml) {
-              // We didn't grab the lock.  We can't read (it may be changing).
-              // Just create and return
-              return creator(ptr);
+          }
+          hazard *h = new hazard;
+          hazard *head = _hazards.load(std::memory_order_relaxed);
+          do {
+            h->next = head;
+          } while (!_hazards.compare_exchange_weak(head, h, std::memory_order_release,
+                                                   std::memory_order_relaxed));
+          return h;
+        }
+
+        hazard &my_hazard() {
+          static thread_local hazard_holder holder(*this);
+          return *holder.h;
+        }
+
+        // Returns the current table, once h is known to protect it.
+        table *protect(hazard &h) {
+          table *t = _current.load(std::memory_order_acquire);
+          while (true) {
+            h.t.store(t, std::memory_order_seq_cst);
+            table *again = _current.load(std::memory_order_seq_cst);
+            if (again == t) {
+              return t;
             }
-            std::shared_ptr<target_base> sp = _ptr.lock();
-            // Could be null, expired, or the wrong one.
-            if (sp.get() != ptr) {
-              sp = creator(ptr);
-              _ptr = sp;
+            t = again;
+          }
+        }
+
+        void maybe_grow(table *t) {
+          if (t->used.load(std::memory_order_relaxed) < t->n_lines * line_entries / 2
+              || t->n_lines * line_entries >= global_cache_size) {
+            return;
+          }
+          table *bigger = new table(t->n_lines * 2);
+          // The entries of old line l go to new lines 2l and 2l+1, so they all fit.
+          for (std::size_t l = 0; l < t->n_lines; l++) {
+            for (entry_type &e : t->lines[l].entries) {
+              const std::uint64_t v = e.load(std::memory_order_relaxed);
+              if (v != 0) {
+                bigger->put(bigger->line_for(v >> 32), v);
+              }
             }
-            return sp;
           }
-        };
+          if (!_current.compare_exchange_strong(t, bigger, std::memory_order_seq_cst)) {
+            delete bigger;
+            return;
+          }
+          std::lock_guard<std::mutex> lk(_retired_mutex);
+          t->retired_next = _retired.load(std::memory_order_relaxed);
+          _retired.store(t, std::memory_order_relaxed);
+        }
+
+        // Frees the replaced tables that no hazard slot names anymore.
+        void reclaim() {
+          std::unique_lock<std::mutex> lk(_retired_mutex, std::try_to_lock);
+          if (!lk.owns_lock()) {
+            return;
+          }
+          table *keep = nullptr;
+          table *t = _retired.load(std::memory_order_relaxed);
+          while (t != nullptr) {
+            table *next = t->retired_next;
+            bool seen = false;
+            for (hazard *h = _hazards.load(std::memory_order_acquire); h != nullptr && !seen; h = h->next) {
+              seen = h->t.load(std::memory_order_seq_cst) == t;
+            }
+            if (seen) {
+              t->retired_next = keep;
+              keep = t;
+            } else {
+              delete t;
+            }
+            t = next;
+          }
+          _retired.store(keep, std::memory_order_relaxed);
+        }
 
-        entry _entries[global_cache_size];
       public:
-        template <typename Creator>
-        std::shared_ptr<target_base> get(target_base *ptr, const Creator &creator) {
-          ptrint i = reinterpret_cast<ptrint>(ptr) & mask;
-          return _entries[i].get(ptr, creator);
+        /*
+         * Returns the first slot in ptr's line for which take() returns true,
+         * or 0.  take() is only called on slots whose tag matches.
+         */
+        template <typename Take>
+        index_type find(target_base *ptr, Take &&take) {
+          // The candidates are collected first, as take() may call erase().
+          index_type candidates[line_entries];
+          std::size_t n = 0;
+          hazard &h = my_hazard();
+          for (entry_type &e : protect(h)->line_for(tag_of(ptr)).entries) {
+            std::uint64_t v = e.load(std::memory_order_relaxed);
+            if (v != 0 && (v >> 32) == tag_of(ptr)) {
+              candidates[n++] = index_type(std::uint32_t(v));
+            }
+          }
+          h.t.store(nullptr, std::memory_order_release);
+          for (std::size_t i = 0; i < n; i++) {
+            if (take(candidates[i])) {
+              return candidates[i];
+            }
+          }
+          return 0;
+        }
+
+        void insert(target_base *ptr, index_type i) {
+          assert(i != 0 && i <= UINT32_MAX);
+          hazard &h = my_hazard();
+          table *t = protect(h);
+          while (true) {
+            line &l = t->line_for(tag_of(ptr));
+            if (t->put(l, entry_for(ptr, i))) {
+              maybe_grow(t);
+            } else {
+              // The line is full, so evict somebody.
+              l.entries[i % line_entries].store(entry_for(ptr, i), std::memory_order_relaxed);
+            }
+            // If the table was replaced meanwhile, the copy may have missed
+            // us, so go again.
+            table *now = protect(h);
+            if (now == t) {
+              break;
+            }
+            t = now;
+          }
+          h.t.store(nullptr, std::memory_order_release);
+          if (_retired.load(std::memory_order_relaxed) != nullptr) {
+            reclaim();
+          }
+        }
+
+        void erase(target_base *ptr, index_type i) {
+          hazard &h = my_hazard();
+          table *t = protect(h);
+          for (entry_type &e : t->line_for(tag_of(ptr)).entries) {
+            std::uint64_t v = entry_for(ptr, i);
+            if (e.load(std::memory_order_relaxed) == v
+                && e.compare_exchange_strong(v, 0, std::memory_order_relaxed)) {
+              t->used.fetch_sub(1, std::memory_order_relaxed);
+              break;
+            }
+          }
+          h.t.store(nullptr, std::memory_order_release);
         }
 
         static global_cache &instance() {
           static global_cache c;
           return c;
         }
-
-
       };
 
       class inbound_table {
       public:
 
+        /*
+         * refs counts the handles on the slot.  A slot that isn't in use
+         * has the dead bit set, so that a thread that finds it through the
+         * global cache just after the last handle went away backs off
+         * rather than resurrecting it.
+         */
         struct slot {
+          constexpr static std::uint32_t dead = 1u<<31;
+
           gc_ptr<target_base> ptr;
           index_type next_free = 0;
+          std::atomic<std::uint32_t> refs{dead};
+
           void reset(const gc_anchor &p) {
             assert(ptr == nullptr);
             ptr = p;
             next_free = 0;
+            // Not a store, as somebody may be in the middle of backing off.
+            refs.fetch_sub(dead - 1, std::memory_order_release);
           }
           void release(index_type nf) {
             next_free = nf;
             ptr = nullptr;
           }
+          bool try_ref() {
+            if (refs.fetch_add(1, std::memory_order_acquire) & dead) {
+              refs.fetch_sub(1, std::memory_order_relaxed);
+              return false;
+            }
+            return true;
+          }
+          // True if this dropped the last handle, in which case the slot is
+          // now dead and the caller must release it.
+          bool unref() {
+            if (refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+              return false;
+            }
+            std::uint32_t zero = 0;
+            return refs.compare_exchange_strong(zero, dead, std::memory_order_acq_rel);
+          }
         };
 
 
-        using block_type = std::array<slot, block_size>;
-        using spine_type = std::array<std::unique_ptr<block_type>, n_blocks>;
+        /*
+         * Any change to a slot marks its block dirty.  The GC thread keeps,
+         * for every block, the non-null pointers it found the last time it
+         * scanned it, and only rescans blocks that have been dirtied since.
+         * The summary is only ever touched by the GC thread.
+         */
+        struct block_type {
+          std::array<slot, block_size> slots;
+          std::atomic<bool> dirty{true};
+          std::vector<offset_ptr<const gc_allocated>> summary;
+
+          // Always stored, even if already set.  Skipping the store would
+          // need a full fence to keep the GC from clearing the flag before
+          // it could see the change to the slot.  Blocks are per thread, so
+          // the line is usually ours anyway.
+          void touch() {
+            dirty.store(true, std::memory_order_release);
+          }
+        };
+        using spine_type = std::array<std::atomic<block_type*>, n_blocks>;
 
+        /*
+         * Each thread's ic_control claims whole blocks with a bump of
+         * _n_blocks and hands out their slots with no further
+         * synchronization.  The only thing shared after that is
+         * _orphans, the free lists of threads that have gone away, which
+         * is taken as a whole and so doesn't need a lock or a
+         * version.  Slot 0 is never handed out, as index 0 ends the free
+         * lists.
+         */
         spine_type _spine;
-        volatile index_type _first_empty_block = 0;
-        index_type _first_empty_slot = block_size;
-        std::stack<index_type> _free_lists;
-        std::mutex _mutex;
-
-        using lock_type = std::lock_guard<std::mutex>;
+        std::atomic<index_type> _n_blocks{0};
+        std::atomic<index_type> _orphans{0};
 
         /*
          * This should probably be private and friended to mpgc::gc_handshake::initialize();
@@ -176,9 +429,12 @@ namespace mpgc {
           return *t;
         }
 
+        block_type &block(index_type b) {
+          return *_spine[b].load(std::memory_order_acquire);
+        }
+
         slot &lookup(index_type b, index_type i) {
-          auto &block = _spine[b];
-          return (*block)[i];
+          return block(b).slots[i];
         }
 
         slot &operator[](index_type i) {
@@ -187,53 +443,126 @@ namespace mpgc {
           return lookup(b, s);
         }
 
+        /*
+         * Called from the GC thread while the mutators are running.  A
+         * block that has been claimed but not yet published is skipped,
+         * as none of its slots can have been handed out.
+         */
         template <typename Fn>
         void for_each_slot(Fn&& func) {
-          for (index_type b = 0; b < _first_empty_block; b++) {
-            auto &block = *_spine[b];
-            for (slot &slot : block) {
+          const index_type n = std::min(_n_blocks.load(std::memory_order_acquire), n_blocks);
+          for (index_type b = 0; b < n; b++) {
+            block_type *block = _spine[b].load(std::memory_order_acquire);
+            if (block == nullptr) {
+              continue;
+            }
+            for (slot &slot : block->slots) {
               std::forward<Fn>(func)(slot.ptr.as_offset_pointer());
             }
           }
         }
 
+        /*
+         * Like for_each_slot(), but only calls func on non-null pointers
+         * and only reads the slots of blocks that have changed since the
+         * last call, taking the rest from their summaries.  A slot that
+         * changes while its block is being rescanned dirties the block
+         * again, so it's picked up next time.  If it was set, the write
+         * barrier has already taken care of this cycle, just as it does
+         * when a full scan reads a slot before it's stored to.  GC thread
+         * only.
+         *
+         * Clean blocks are not skipped, only their empty slots are.  Marks
+         * don't carry over from one cycle to the next, so every root has
+         * to be handed to func every cycle, even if it was there last
+         * time.  It's up to func to skip the ones already marked in this
+         * cycle, as capture_global_roots() does.
+         */
+        template <typename Fn>
+        void for_each_root(Fn&& func) {
+          const index_type n = std::min(_n_blocks.load(std::memory_order_acquire), n_blocks);
+          for (index_type b = 0; b < n; b++) {
+            block_type *block = _spine[b].load(std::memory_order_acquire);
+            if (block == nullptr) {
+              continue;
+            }
+            if (block->dirty.load(std::memory_order_relaxed)
+                && block->dirty.exchange(false, std::memory_order_acquire)) {
+              block->summary.clear();
+              for (slot &slot : block->slots) {
+                offset_ptr<const gc_allocated> p = slot.ptr.as_offset_pointer();
+                if (p != nullptr) {
+                  block->summary.push_back(p);
+                }
+              }
+            }
+            for (const offset_ptr<const gc_allocated> &p : block->summary) {
+              std::forward<Fn>(func)(p);
+            }
+          }
+        }
+
+        void set(index_type i, const gc_anchor &p) {
+          block_type &b = block(i / block_size);
+          b.slots[i % block_size].reset(p);
+          b.touch();
+        }
+
+        void release(index_type i, index_type next_free) {
+          block_type &b = block(i / block_size);
+          b.slots[i % block_size].release(next_free);
+          b.touch();
+        }
+
         constexpr static index_type index_of(index_type b, index_type i) {
           return b*block_size + i;
         }
-        index_type get_free_list() {
-          lock_type lock(_mutex);
-          if (_free_lists.empty()) {
-            if (_first_empty_slot == block_size) {
-              _spine[_first_empty_block] = std::make_unique<block_type>();
-              /* We must guarantee that the assignment takes before we increment
-               * _first_empty_block otherwise there exist a race where the gc thread
-               * may try to access an uninitialized block.
-               */
-              _first_empty_block++;
-              _first_empty_slot = 0;
-            }
-            index_type b = _first_empty_block-1;
-            lookup(b, _first_empty_slot).next_free = 0;
-            index_type head = index_of(b, _first_empty_slot);
-            _first_empty_slot++;
-            return head;
-          } else {
-            index_type head = _free_lists.top();
-            _free_lists.pop();
-            return head;
+
+        /*
+         * Checked in every build, as running off the end of the spine would
+         * scribble over the rest of the table.  There's no recovering from
+         * it, as the slots are handed out to constructors that can't fail.
+         */
+        index_type claim_block() {
+          index_type b = _n_blocks.fetch_add(1, std::memory_order_relaxed);
+          if (b >= n_blocks) {
+            std::cerr << "mpgc: out of inbound pointer slots (" << n_blocks * block_size
+                      << " external_gc_ptrs live at once)" << std::endl;
+            std::abort();
+          }
+          _spine[b].store(new block_type, std::memory_order_release);
+          return b;
+        }
+
+        // Returns the whole list of orphaned slots, or 0 if there isn't one.
+        index_type adopt_orphans() {
+          if (_orphans.load(std::memory_order_relaxed) == 0) {
+            return 0;
           }
+          return _orphans.exchange(0, std::memory_order_acquire);
         }
 
-        void release_free_list(index_type head) {
-          lock_type lock(_mutex);
-          _free_lists.push(head);
+        void orphan(index_type head, index_type tail) {
+          index_type old = _orphans.load(std::memory_order_relaxed);
+          do {
+            (*this)[tail].next_free = old;
+          } while (!_orphans.compare_exchange_weak(old, head,
+                                                   std::memory_order_release,
+                                                   std::memory_order_relaxed));
         }
       };
 
       class ic_control {
       public:
+        using slot = inbound_table::slot;
         constexpr static ptrint mask = local_cache_size -1;
-        using cache_type = std::array<std::weak_ptr<target_base>, local_cache_size>;
+        // Doesn't hold references, so entries are checked just like the
+        // global cache's.
+        struct cached {
+          target_base *ptr = nullptr;
+          index_type index = 0;
+        };
+        using cache_type = std::array<cached, local_cache_size>;
 
         inbound_table &_table = inbound_table::table();
         global_cache &_global_cache = global_cache::instance();
@@ -241,68 +570,133 @@ namespace mpgc {
         cache_type &_local_cache = *_local_cache_ptr;
 
         index_type _free = 0;
+        index_type _block = 0;
+        index_type _next_slot = block_size;
 
         ~ic_control() {
+          // Whatever is left of our block goes with the free list.
+          while (_next_slot < block_size) {
+            release(inbound_table::index_of(_block, _next_slot++));
+          }
           if (_free != 0) {
-            _table.release_free_list(_free);
+            index_type tail = _free;
+            while (_table[tail].next_free != 0) {
+              tail = _table[tail].next_free;
+            }
+            _table.orphan(_free, tail);
           }
         }
 
+        index_type allocate_slot() {
+          if (_free == 0 && _next_slot == block_size) {
+            _free = _table.adopt_orphans();
+            if (_free == 0) {
+              _block = _table.claim_block();
+              _next_slot = _block == 0 ? 1 : 0;
+            }
+          }
+          if (_free != 0) {
+            index_type i = _free;
+            _free = _table[i].next_free;
+            return i;
+          }
+          return inbound_table::index_of(_block, _next_slot++);
+        }
+
         static ic_control &block() {
           static thread_local ic_control b;
           return b;
         }
 
         void release(index_type index) {
-          auto &slot = _table[index];
-          slot.release(_free);
+          _table.release(index, _free);
           _free = index;
         }
 
+        void unref(index_type index) {
+          slot &s = _table[index];
+          if (s.unref()) {
+            _global_cache.erase(s.ptr.as_bare_pointer(), index);
+            release(index);
+          }
+        }
+
+        static void add_ref(index_type index) {
+          inbound_table::table()[index].refs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        static void drop_ref(index_type index) {
+          block().unref(index);
+        }
+
+        // Takes a reference to index if it's live and still holds p.
+        bool try_take(index_type index, target_base *p) {
+          slot &s = _table[index];
+          if (!s.try_ref()) {
+            return false;
+          }
+          if (s.ptr.as_bare_pointer() != p) {
+            // Reused for something else since it was cached.
+            unref(index);
+            return false;
+          }
+          return true;
+        }
+
+        /*
+         * Returns the index of a slot holding gcp, with a reference taken
+         * for the caller, or 0 if gcp is null.
+         */
         template <typename T>
-        std::shared_ptr<T> lookup(const gc_ptr<T> &gcp) {
+        index_type lookup(const gc_ptr<T> &gcp) {
           if (gcp == nullptr) {
-            return nullptr;
+            return 0;
           }
           target_base *p = gcp.as_bare_pointer();
-          ptrint i = reinterpret_cast<ptrint>(p) & mask;
-          std::weak_ptr<target_base> &wp = _local_cache[i];
-          std::shared_ptr<target_base> sp = wp.lock();
-          if (sp == nullptr) {
-            auto create = [this, &gcp](target_base *ptr) {
-              if (_free == 0) {
-                _free = _table.get_free_list();
-              }
-              index_type i = _free;
-              auto &slot = _table[i];
-              _free = slot.next_free;
-              slot.reset(gcp);
-              auto deleter = [i](target_base *) {
-                ic_control::block().release(i);
-              };
-              std::shared_ptr<target_base> res{ptr, deleter};
-              return res;
-            };
-            sp = _global_cache.get(p, create);
-          }
-          std::shared_ptr<const T> cp = std::static_pointer_cast<const T>(sp);
-          return std::const_pointer_cast<T>(cp);
+          cached &c = _local_cache[reinterpret_cast<ptrint>(p) & mask];
+          if (c.ptr == p && try_take(c.index, p)) {
+            return c.index;
+          }
+          index_type i = _global_cache.find(p, [this, p](index_type i) {
+              return try_take(i, p);
+            });
+          if (i == 0) {
+            i = allocate_slot();
+            _table.set(i, gcp);
+            _global_cache.insert(p, i);
+          }
+          c.ptr = p;
+          c.index = i;
+          return i;
         }
 
       };
 
     }
+    /*
+     * A handle on an inbound table slot, whose count of handles is the
+     * reference count, so copying one is a single relaxed increment.
+     */
     template <typename T>
     class external_gc_ptr
     {
-      std::shared_ptr<T> _shared_ptr;
+      using ic_control = inbound_pointers::ic_control;
+      using index_type = inbound_pointers::index_type;
+
+      T *_ptr = nullptr;
+      index_type _slot = 0;
+
       T *bare_ptr() const {
-        return _shared_ptr.get();
+        return _ptr;
+      }
+      // Takes another reference on slot, unless p is null.
+      external_gc_ptr(T *p, index_type slot)
+      : _ptr{p}, _slot{p == nullptr ? 0 : slot}
+      {
+        if (_slot != 0) {
+          ic_control::add_ref(_slot);
+        }
       }
-      template <typename X, typename = std::enable_if_t<is_gc_allocated<X>::value>>
-      explicit external_gc_ptr(const std::shared_ptr<X> &sp)
-      : _shared_ptr(sp)
-      {}
 
       template <typename X> using compatible = std::enable_if_t<std::is_convertible<X*,T*>::value>;
       template <typename X> friend class external_gc_ptr;
@@ -312,32 +706,54 @@ namespace mpgc {
 
       template <typename X, typename = compatible<X> >
       external_gc_ptr(const gc_ptr<X> &ptr)
-      : external_gc_ptr{inbound_pointers::ic_control::block().lookup(ptr)}
+      : _ptr{ptr.as_bare_pointer()}, _slot{ic_control::block().lookup(ptr)}
       {}
 
-      external_gc_ptr(const external_gc_ptr &) = default;
+      external_gc_ptr(const external_gc_ptr &ptr)
+      : external_gc_ptr{ptr._ptr, ptr._slot}
+      {}
       template <typename X, typename = compatible<X> >
       external_gc_ptr(const external_gc_ptr<X> &ptr)
-      : _shared_ptr{ptr._shared_ptr}
+      : external_gc_ptr{ptr._ptr, ptr._slot}
       {}
 
-      external_gc_ptr(external_gc_ptr &&) = default;
+      external_gc_ptr(external_gc_ptr &&ptr)
+      : _ptr{ptr._ptr}, _slot{ptr._slot}
+      {
+        ptr._ptr = nullptr;
+        ptr._slot = 0;
+      }
       template <typename X, typename = compatible<X> >
       external_gc_ptr(external_gc_ptr<X> &&ptr)
-      : _shared_ptr{std::move(ptr._shared_ptr)}
-      {}
+      : _ptr{ptr._ptr}, _slot{ptr._slot}
+      {
+        ptr._ptr = nullptr;
+        ptr._slot = 0;
+      }
+
+      ~external_gc_ptr() {
+        if (_slot != 0) {
+          ic_control::drop_ref(_slot);
+        }
+      }
 
-      external_gc_ptr &operator =(const external_gc_ptr &) = default;
+      external_gc_ptr &operator =(const external_gc_ptr &ptr) {
+        external_gc_ptr{ptr}.swap(*this);
+        return *this;
+      }
       template <typename X, typename = compatible<X> >
       external_gc_ptr &operator =(const external_gc_ptr<X> &ptr) {
-        _shared_ptr = ptr._shared_ptr;
+        external_gc_ptr{ptr}.swap(*this);
         return *this;
       }
 
-      external_gc_ptr &operator =(external_gc_ptr &&) = default;
+      external_gc_ptr &operator =(external_gc_ptr &&ptr) {
+        external_gc_ptr{std::move(ptr)}.swap(*this);
+        return *this;
+      }
       template <typename X, typename = compatible<X> >
       external_gc_ptr &operator =(external_gc_ptr<X> &&ptr) {
-        _shared_ptr = std::move(ptr._shared_ptr);
+        external_gc_ptr{std::move(ptr)}.swap(*this);
         return *this;
       }
 
@@ -360,24 +776,24 @@ namespace mpgc {
         return bare_ptr();
       }
       bool is_null() const {
-        return !_shared_ptr;
+        return _ptr == nullptr;
       }
 
       template <typename X>
       bool operator==(const external_gc_ptr<X> &rhs) const {
-        return _shared_ptr == rhs._shared_ptr;
+        return _ptr == rhs._ptr;
       }
       template <typename X>
       bool operator==(const std::shared_ptr<X> &rhs) const {
-        return _shared_ptr == rhs._shared_ptr;
+        return _ptr == rhs.get();
       }
       template <typename X>
       bool operator==(const gc_ptr<X> &rhs) const {
-        return _shared_ptr.get() == rhs.as_bare_pointer();
+        return _ptr == rhs.as_bare_pointer();
       }
 
       bool operator==(const T *rhs) const {
-        return _shared_ptr.get() == rhs;
+        return _ptr == rhs;
       }
       bool operator==(nullptr_t) const {
         return is_null();
@@ -388,7 +804,8 @@ namespace mpgc {
       }
 
       void swap(external_gc_ptr &other) {
-        std::swap(_shared_ptr, other._shared_ptr);
+        std::swap(_ptr, other._ptr);
+        std::swap(_slot, other._slot);
       }
 
       template <typename X, typename Y> friend external_gc_ptr<X> std::static_pointer_cast(const external_gc_ptr<Y> &);
@@ -404,67 +821,67 @@ namespace mpgc {
 
       template <typename S=T, typename E=std::enable_if_t<is_gc_array<S>::value> >
       typename S::size_type size() const {
-        return _shared_ptr == nullptr ? 0 : _shared_ptr->size();
+        return _ptr == nullptr ? 0 : _ptr->size();
       }
       template <typename S=T, typename E=std::enable_if_t<is_gc_array<S>::value> >
       bool empty() const {
         /* There shouldn't be an array if the size is zero */
-        return _shared_ptr == nullptr;
+        return _ptr == nullptr;
       }
 
       template <typename S=T, typename E=std::enable_if_t<is_gc_array<S>::value> >
       auto &operator[](typename S::size_type pos) const {
         // throw something if null
-        return (*_shared_ptr)[pos];
+        return (*_ptr)[pos];
       }
 
       template <typename S=T, typename E=std::enable_if_t<is_gc_array<S>::value && std::is_const<S>::value >>
                                                     operator typename S::const_iterator() const {
-        return _shared_ptr == nullptr ? typename S::const_iterator{} : _shared_ptr->cbegin();
+        return _ptr == nullptr ? typename S::const_iterator{} : _ptr->cbegin();
       }
 
       template <typename S=T, typename E=std::enable_if_t<is_gc_array<S>::value && !std::is_const<S>::value >>
                                                      operator typename S::iterator() const {
-        return _shared_ptr == nullptr ? typename S::iterator{} : _shared_ptr->begin();
+        return _ptr == nullptr ? typename S::iterator{} : _ptr->begin();
       }
 
       template <typename S=T, typename E=std::enable_if_t<is_gc_array<S>::value>>
                                                      auto operator +(typename S::const_iterator::difference_type delta) const {
-        // If _shared_ptr is null, delta had better be zero.  To be safe, we'll just return null
-        return _shared_ptr == nullptr ? decltype(_shared_ptr->begin()+delta){} : _shared_ptr->begin()+delta;
+        // If _ptr is null, delta had better be zero.  To be safe, we'll just return null
+        return _ptr == nullptr ? decltype(_ptr->begin()+delta){} : _ptr->begin()+delta;
       }
 
       template <typename S=T, typename E=std::enable_if_t<is_gc_array<S>::value>>
         auto begin() const {
-        return _shared_ptr == nullptr ? decltype(_shared_ptr->begin()){} : _shared_ptr->begin();
+        return _ptr == nullptr ? decltype(_ptr->begin()){} : _ptr->begin();
       }
       template <typename S=T, typename E=std::enable_if_t<is_gc_array<S>::value>>
         auto end() const {
-        return _shared_ptr == nullptr ? decltype(_shared_ptr->end()){} : _shared_ptr->end();
+        return _ptr == nullptr ? decltype(_ptr->end()){} : _ptr->end();
       }
       template <typename S=T, typename E=std::enable_if_t<is_gc_array<S>::value>>
         auto cbegin() const {
-        return _shared_ptr == nullptr ? decltype(_shared_ptr->cbegin()){} : _shared_ptr->cbegin();
+        return _ptr == nullptr ? decltype(_ptr->cbegin()){} : _ptr->cbegin();
       }
       template <typename S=T, typename E=std::enable_if_t<is_gc_array<S>::value>>
         auto cend() const {
-        return _shared_ptr == nullptr ? decltype(_shared_ptr->cend()){} : _shared_ptr->cend();
+        return _ptr == nullptr ? decltype(_ptr->cend()){} : _ptr->cend();
       }
       template <typename S=T, typename E=std::enable_if_t<is_gc_array<S>::value>>
         auto rbegin() const {
-        return _shared_ptr == nullptr ? decltype(_shared_ptr->rbegin()){} : _shared_ptr->rbegin();
+        return _ptr == nullptr ? decltype(_ptr->rbegin()){} : _ptr->rbegin();
       }
       template <typename S=T, typename E=std::enable_if_t<is_gc_array<S>::value>>
         auto rend() const {
-        return _shared_ptr == nullptr ? decltype(_shared_ptr->rend()){} : _shared_ptr->rend();
+        return _ptr == nullptr ? decltype(_ptr->rend()){} : _ptr->rend();
       }
       template <typename S=T, typename E=std::enable_if_t<is_gc_array<S>::value>>
         auto crbegin() const {
-        return _shared_ptr == nullptr ? decltype(_shared_ptr->crbegin()){} : _shared_ptr->crbegin();
+        return _ptr == nullptr ? decltype(_ptr->crbegin()){} : _ptr->crbegin();
       }
       template <typename S=T, typename E=std::enable_if_t<is_gc_array<S>::value>>
         auto crend() const {
-        return _shared_ptr == nullptr ? decltype(_shared_ptr->crend()){} : _shared_ptr->crend();
+        return _ptr == nullptr ? decltype(_ptr->crend()){} : _ptr->crend();
       }
 
 
@@ -843,21 +1260,21 @@ namespace std {
   template <typename T, typename U>
   mpgc::external_gc_ptr<T>
   static_pointer_cast(const mpgc::external_gc_ptr<U> &r) {
-    return mpgc::external_gc_ptr<T>(std::static_pointer_cast<T>(r._shared_ptr));
+    return mpgc::external_gc_ptr<T>(static_cast<T*>(r._ptr), r._slot);
   }
 
   template <typename T, typename U>
   inline
   mpgc::external_gc_ptr<T>
   dynamic_pointer_cast(const mpgc::external_gc_ptr<U> &r) {
-    return mpgc::external_gc_ptr<T>(std::dynamic_pointer_cast<T>(r._shared_ptr));
+    return mpgc::external_gc_ptr<T>(dynamic_cast<T*>(r._ptr), r._slot);
   }
 
   template <typename T, typename U>
   inline
   mpgc::external_gc_ptr<T>
   const_pointer_cast(const mpgc::external_gc_ptr<U> &r) {
-    return mpgc::external_gc_ptr<T>(std::const_pointer_cast<T>(r._shared_ptr));
+    return mpgc::external_gc_ptr<T>(const_cast<T*>(r._ptr), r._slot);
   }
 
   template <typename T>
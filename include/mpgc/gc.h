@@ -48,9 +48,19 @@
 #include "mpgc/gc_handshake.h"
 #include "mpgc/external_gc_ptr.h"
 #include "mpgc/gc_cuckoo_map.h"
+#include "mpgc/gc_telemetry.h"
+#include "mpgc/gc_census.h"
 
 #include "ruts/collections.h"
 #include "ruts/managed.h"
+#include "ruts/util.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace mpgc {
   typedef ruts::parallel_lazy_delete_collection<per_process_struct, ruts::managed_space::allocator<per_process_struct>> perProcessList;
@@ -126,10 +136,13 @@ namespace mpgc {
 	return expected;
       }
     }
-    void marked(const offset_ptr<const gc_allocated> &p) {
-      std::size_t bytes = p->get_gc_descriptor().object_size()*8;
+    /* Marking is counted per process and allocation per thread. Every GC
+     * thread folds its share in here once per cycle, before sweep2 ends,
+     * along with the marked counts of any process that died.
+     */
+    void marked(std::size_t bytes, std::size_t n) {
       in_use_current += bytes;
-      n_objects_current++;
+      n_objects_current += n;
     }
   };
 
@@ -193,56 +206,175 @@ namespace mpgc {
      * various subsystems. The roots are established and looked up by
      * key, and we assume that key allocation takes place by some
      * external process.  We also provide a way to say "Atomically
-     * establish a value if one doesn't exist.  For now, we simply use
-     * a smallish array.  This should probably be generalized.
+     * establish a value if one doesn't exist.
+     *
+     * The keys are spread over a number of cuckoo maps (shards), so
+     * that lots of roots don't all churn one map.  The number of
+     * shards and their initial capacity come from
+     * MPGC_PERSISTENT_ROOT_SHARDS and MPGC_PERSISTENT_ROOT_CAPACITY in
+     * whichever process creates the heap, and are fixed from then on.
      */
 
     using key_type = persistent_root_key;
     using ptr_type = gc_ptr<gc_allocated>;
     using map_type = small_gc_cuckoo_map<key_type, ptr_type>;
+    using shards_type = gc_array<map_type>;
+
+    constexpr static std::size_t default_shards = 16;
+    constexpr static std::size_t default_shard_capacity = 64;
 
   private:
-    mutable std::atomic<gc_ptr<map_type>> _map;
-    gc_ptr<map_type> map() const {
-      return _map;
+    mutable std::atomic<gc_ptr<shards_type>> _map;
+
+    /*
+     * The shard array is never replaced once it's there, so where the
+     * shards are is kept alongside _map, and lookups don't go through
+     * _map and the array.  Every process stores the same values when it
+     * attaches (ensure_initialized()), so it doesn't matter who's last.
+     */
+    struct shard_view {
+      std::atomic<offset_ptr<const gc_ptr<map_type>>> shards;
+      std::atomic<std::size_t> n{0};
+      std::atomic<offset_ptr<gc_allocated>> pending;
+    };
+    shard_view _view;
+
+    gc_ptr<map_type> map(const key_type &key) const {
+      const gc_ptr<map_type> *shards = _view.shards.load(std::memory_order_relaxed).as_bare_pointer();
+      const std::size_t n = _view.n.load(std::memory_order_relaxed);
+      // The maps hash with the low bits, so use the high ones.
+      return shards[(ruts::hash1<ruts::uniform_key>{}(key.id) >> 40) % n];
+    }
+    gc_allocated *pending_tag() const {
+      return _view.pending.load(std::memory_order_relaxed).as_bare_pointer();
+    }
+
+    /*
+     * find_or_create() claims a key by storing one of these while it
+     * creates the value, and everybody else waits for it to be replaced.
+     * It says which process is creating the value (with the start time,
+     * as pids get reused), so that if that process dies the others can
+     * take the key over.  The tag is the shard array, which nobody else
+     * can get hold of, so a claim can't be mistaken for a stored value.
+     */
+    struct claim : gc_allocated {
+      gc_ptr<gc_allocated> tag;
+      std::uint64_t pid;
+      std::uint64_t creation_time;
+
+      claim(gc_token &gc, const gc_ptr<gc_allocated> &t, const per_process_struct::liveness &owner)
+        : gc_allocated{gc}, tag{t}, pid(owner.pid), creation_time(owner.creation_time) {}
+
+      static const auto &descriptor() {
+        static gc_descriptor d =
+          GC_DESC(claim)
+          .WITH_FIELD(&claim::tag)
+          .WITH_FIELD(&claim::pid)
+          .WITH_FIELD(&claim::creation_time);
+        return d;
+      }
+    };
+
+    gc_ptr<claim> make_claim() const {
+      return make_gc<claim>(gc_ptr_from_bare_ptr(pending_tag()), gc_handshake::process_struct->get_liveness());
+    }
+    /*
+     * Compact descriptors are shared by all types with the same layout,
+     * so a matching descriptor only says it might be a claim.  The tag
+     * settles it.
+     */
+    bool is_pending(const ptr_type &p) const {
+      if (p == nullptr || p->get_gc_descriptor().type_key() != claim::descriptor().type_key()) {
+        return false;
+      }
+      return static_cast<const claim *>(p.as_bare_pointer())->tag.as_bare_pointer() == pending_tag();
     }
+    /*
+     * The same check cleanup_failures() makes.  It reads /proc, so
+     * waiters only make it every so often.
+     */
+    static bool claimant_died(const ptr_type &p) {
+      const claim *c = static_cast<const claim *>(p.as_bare_pointer());
+      return per_process_struct::get_creation_time(pid_t(c->pid)) != c->creation_time;
+    }
+    constexpr static unsigned claim_check_every = 1024;
+
+    /*
+     * The keys this thread is creating values for.  A claim of ours is
+     * waited for like anybody else's, so find_or() checks here first
+     * and fails rather than wait for itself.
+     */
+    static std::vector<key_type> &keys_being_created() {
+      static thread_local std::vector<key_type> keys;
+      return keys;
+    }
+    static void check_not_creating(const key_type &key) {
+      const std::vector<key_type> &keys = keys_being_created();
+      if (std::find(keys.begin(), keys.end(), key) != keys.end()) {
+        std::cerr << "mpgc: find_or_create() for persistent root " << key
+                  << " called again while creating its value" << std::endl;
+        std::abort();
+      }
+    }
+
+    static std::size_t from_env(const char *var, std::size_t dflt) {
+      const std::string v = ruts::env_string(var);
+      const std::size_t n = v.empty() ? 0 : std::strtoul(v.c_str(), nullptr, 0);
+      return n == 0 ? dflt : n;
+    }
+
   public:
 
     persistent_roots_t &ensure_initialized() {
-      if (map() == nullptr) {
+      if (_map.load() == nullptr) {
         /*
          * Nobody's done this yet.
          */
-        ruts::try_change_value(_map, nullptr, make_gc<map_type>(100));
+        const std::size_t n = from_env("MPGC_PERSISTENT_ROOT_SHARDS", default_shards);
+        const std::size_t cap = from_env("MPGC_PERSISTENT_ROOT_CAPACITY", default_shard_capacity);
+        gc_ptr<shards_type> shards = make_gc_array<map_type>(n);
+        for (std::size_t i = 0; i < n; i++) {
+          (*shards)[i] = make_gc<map_type>(cap);
+        }
+        ruts::try_change_value(_map, nullptr, shards);
         /*
          * If that didn't work, it means that somebody else got there
-         * first and the map we created was dropped on the floor.
+         * first and the shards we created were dropped on the floor.
          * That's okay.
          */
       }
+      gc_ptr<shards_type> s = _map;
+      _view.shards.store(&(*s)[0], std::memory_order_relaxed);
+      _view.n.store(s->size(), std::memory_order_relaxed);
+      _view.pending.store(s.as_bare_pointer(), std::memory_order_relaxed);
       return *this;
     }
 
     template <typename Fn>
     void enumerate_pointers(const Fn &fn) const {
-      fn(map());
+      fn(_map.load());
     }
 
     bool remove(key_type key) {
-      return map()->remove(key);
+      return map(key)->remove(key);
     }
 
     bool contains(key_type key) {
-      return map()->contains(key);
+      bool has_val;
+      ptr_type current;
+      std::tie(has_val, current) = map(key)->lookup(key);
+      return has_val && !is_pending(current);
     }
 
     /*
      * Note that lookup doesn't check that it is actually of that
-     * type.  It's assumed that the caller knows.
+     * type.  It's assumed that the caller knows.  A key that's still
+     * being created by find_or_create() looks absent.
      */
     template <typename T>
     gc_ptr<T> lookup(key_type key) const {
-      return std::static_pointer_cast<T>(map()->get(key));
+      ptr_type current = map(key)->get(key);
+      return is_pending(current) ? nullptr : std::static_pointer_cast<T>(current);
     }
 
     /*
@@ -251,58 +383,112 @@ namespace mpgc {
      */
     template <typename T>
     gc_ptr<T> swap(key_type key, const gc_ptr<T> &new_val) {
-      auto rr = map()->put(key, new_val);
-      return std::static_pointer_cast<T>(rr.old_value);
+      auto rr = map(key)->put(key, new_val);
+      return is_pending(rr.old_value) ? nullptr : std::static_pointer_cast<T>(rr.old_value);
     }
 
     template <typename T>
     void store(key_type key, const gc_ptr<T> &new_val) {
-      map()->put(key, new_val);
+      map(key)->put(key, new_val);
     }
 
     /*
      * Returns the resulting value (the one that was there or the one
      * we set).  Note that "new" means "There was no value there".  A
-     * value of null counts as a value.
+     * value of null counts as a value.  If the key is claimed, waits for
+     * the claimant's value, unless the claimant has died, in which case
+     * ours goes in instead.
      */
     template <typename T>
     gc_ptr<T> store_new(key_type key, const gc_ptr<T> &new_val) {
-      gc_ptr<map_type> m = map();
-
-      bool has_val;
-      ptr_type current;
-      std::tie(has_val, current) = m->lookup(key);
-
-      if (has_val) {
-        return std::static_pointer_cast<T>(current);
-      }
-
-      auto rr = m->put_new(key, new_val);
-      if (rr.replaced) {
-        return new_val;
-      } else {
-        return std::static_pointer_cast<T>(rr.old_value);
+      gc_ptr<map_type> m = map(key);
+      for (unsigned spins = 1; ; spins++) {
+        bool has_val;
+        ptr_type current;
+        std::tie(has_val, current) = m->lookup(key);
+        if (!has_val) {
+          if (m->put_new(key, new_val).replaced) {
+            return new_val;
+          }
+        } else if (!is_pending(current)) {
+          return std::static_pointer_cast<T>(current);
+        } else if (spins % claim_check_every == 0 && claimant_died(current)) {
+          if (m->replace(key, current, new_val).replaced) {
+            return new_val;
+          }
+        } else {
+          std::this_thread::yield();
+        }
       }
     }
 
     template <typename T>
     bool replace(key_type key, gc_ptr<T> &expected, const gc_ptr<T> &new_val) {
-      auto rr = map()->replace(key, expected, new_val);
+      auto rr = map(key)->replace(key, expected, new_val);
       if (!rr.replaced) {
         expected = std::static_pointer_cast<T>(rr.old_value);
       }
       return rr.replaced;
     }
 
+    /*
+     * Only calls fn if the key is absent and we manage to claim it, so a
+     * process that loses the race doesn't build a value just to throw it
+     * away.  The others wait for the winner's value.  If the winner dies
+     * in fn, one of them takes the claim over and calls fn itself.  fn
+     * mustn't look the same key up with find_or(), which would wait for
+     * itself forever, so that aborts.
+     */
     template <typename T, typename Fn, typename ... Args>
     gc_ptr<T> find_or(key_type key, const Fn &fn, Args && ...args)
     {
-      gc_ptr<T> current = lookup<T>(key);
-      if (current == nullptr) {
-        gc_ptr<T> new_val = fn(std::forward<Args>(args)...);
-        current = store_new(key, new_val);
+      gc_ptr<map_type> m = map(key);
+      gc_ptr<claim> mine;
+      for (unsigned spins = 1; ; spins++) {
+        bool has_val;
+        ptr_type current;
+        std::tie(has_val, current) = m->lookup(key);
+        if (has_val && !is_pending(current)) {
+          return std::static_pointer_cast<T>(current);
+        }
+        if (has_val && spins == 1) {
+          check_not_creating(key);
+        }
+        if (has_val && (spins % claim_check_every != 0 || !claimant_died(current))) {
+          std::this_thread::yield();
+          continue;
+        }
+        if (mine == nullptr) {
+          mine = make_claim();
+        }
+        const bool claimed = has_val
+          ? m->replace(key, current, mine).replaced
+          : m->put_new(key, mine).replaced;
+        if (!claimed) {
+          continue;
+        }
+        gc_ptr<T> new_val;
+        std::vector<key_type> &creating = keys_being_created();
+        creating.push_back(key);
+        try {
+          new_val = fn(std::forward<Args>(args)...);
+          creating.pop_back();
+        } catch (...) {
+          creating.pop_back();
+          // Racy, but somebody storing into a key we're creating
+          // would have had their value replaced anyway.
+          if (m->get(key) == mine) {
+            m->remove(key);
+          }
+          throw;
+        }
+        if (m->replace(key, mine, new_val).replaced) {
+          return new_val;
+        }
+        // Somebody stored over our claim, and theirs stands, or removed
+        // it, and ours goes in after all.
+        return store_new(key, new_val);
       }
-      return current;
     }
     template <typename T, typename ... Args>
     gc_ptr<T> find_or_create(key_type key, Args && ...args)
@@ -313,6 +499,7 @@ namespace mpgc {
 
   struct gc_control_block {
     gc_allocator::globalListType global_free_list[2];
+    gc_allocator::large_object_table large_objects;
 
     persistent_roots_t persistent_roots;
 
@@ -322,6 +509,8 @@ namespace mpgc {
     perProcessList process_struct_list;
 
     gc_mem_stats mem_stats;
+    gc_telemetry telemetry;
+    heap_census census;
 
     //Total number of processes at any time
     std::atomic<versioned_pcount_t> total_process_count;
@@ -344,7 +533,7 @@ namespace mpgc {
       stage(Stage::Sweeped)
     {
       //assert((reinterpret_cast<std::size_t>(global_free_list.load()) & 0xf) == 0);
-      global_free_list[0][gc_allocator::global_list_index_for(size)] =
+      global_free_list[0][0][gc_allocator::global_list_index_for(size)] =
                    gc_allocator::list_head(new (p) gc_allocator::global_chunk(size));
 
       for (uint8_t i = 0; i < barrier_sync.size(); i++) {
@@ -369,6 +558,18 @@ namespace mpgc {
   }
 
 
+  inline
+  gc_telemetry &telemetry() {
+    initialize_thread();
+    return control_block().telemetry;
+  }
+
+  inline
+  heap_census &census() {
+    initialize_thread();
+    return control_block().census;
+  }
+
   template <typename Fn>
   auto gc_safe(Fn &&fn) {
     typename std::decay<Fn>::type f = std::forward<Fn>(fn);
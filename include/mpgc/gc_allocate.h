@@ -27,8 +27,10 @@
 #ifndef GC_ALLOCATE_H
 #define GC_ALLOCATE_H
 
+#include <algorithm>
 #include <utility>
 #include <iterator>
+#include <tuple>
 
 #include "mpgc/gc_allocator.h"
 #include "mpgc/gc_ptr.h"
@@ -36,6 +38,8 @@
 namespace mpgc {
   extern void allocation_prologue();
   extern void allocation_epilogue(void*, gc_token&, std::size_t);
+  extern void batch_allocation_install(void*, gc_token&, std::size_t, std::size_t);
+  extern void batch_allocation_epilogue(void*, std::size_t, std::size_t);
 
   class gc_managed_placement_t {};
   static const gc_managed_placement_t in_gc_managed_space;
@@ -44,8 +48,18 @@ namespace mpgc {
   class gc_allocator__ {
     template <typename X, typename ...Args>
     friend gc_ptr<X> make_gc(Args&&...args);
+    template <typename X, typename Fn>
+    friend gc_array_ptr<gc_ptr<X>> make_gc_batch(std::size_t, Fn&&);
     template <typename X> friend class gc_allocator__;
 
+    //Keep the regions below the large object threshold.
+    constexpr static std::size_t batch_region_size = gc_allocator::large_object_min_size - sizeof(std::size_t);
+
+    template <typename Tuple, std::size_t ...I>
+    static void construct(void *ptr, gc_token &tok, Tuple &&args, std::index_sequence<I...>) {
+      new (ptr) T(tok, std::get<I>(std::forward<Tuple>(args))...);
+    }
+
     static void check_descriptor() {
       // Check to make sure it's declared
       desc_for<T>();
@@ -68,6 +82,52 @@ namespace mpgc {
       assert(&(res->get_gc_descriptor()) == ptr);
       return gc_ptr_from_bare_ptr(res);
     }
+
+    /*
+     * The objects are carved out of a few contiguous regions, each going
+     * through the allocation handshake once. They are put in the returned
+     * array before the handshake ends, so that they are reachable before
+     * any of them is constructed.
+     *
+     * Each region is constructed right after its own epilogue, just like
+     * make_gc() constructs after allocation_epilogue(). It can't be done
+     * before the epilogue, as constructors (and init_fn) may allocate, and
+     * the nested epilogue would let the sweep signal in half way through.
+     * Constructing without barriers after the epilogue is safe for the
+     * same reason it is in make_gc(), whatever phase (or cycle) we're in
+     * by then. The fields are still null, so the async phase's barrier,
+     * which grays the old value, would have nothing to gray. In the sync
+     * phases marking hasn't started yet, so the object, being reachable
+     * from the array, is traced later along with whatever was stored.
+     */
+    template <typename Fn>
+    gc_array_ptr<gc_ptr<T>> allocate_batch(std::size_t n, Fn &&init_fn) {
+      gc_descriptor valdesc = desc_for<T>();
+      assert(valdesc.object_size()*8 == sizeof(T));
+      gc_token tok(valdesc);
+      static_assert(is_collectible<T>::value,
+                    "Has non-trivial destructor and no is_collectible<T> specialization");
+
+      gc_array_ptr<gc_ptr<T>> res = make_gc_array<gc_ptr<T>>(n);
+      const std::size_t per_region = std::max<std::size_t>(1, batch_region_size / sizeof(T));
+      for (std::size_t i = 0; i < n; i += per_region) {
+        const std::size_t k = std::min(per_region, n - i);
+        allocation_prologue();
+        uint8_t *ptr = static_cast<uint8_t*>(gc_allocator::alloc(sizeof(T) * k));
+        batch_allocation_install(ptr, tok, sizeof(T), k);
+        for (std::size_t j = 0; j < k; j++) {
+          res[i + j] = gc_ptr_from_bare_ptr(reinterpret_cast<T*>(ptr + j * sizeof(T)));
+        }
+        batch_allocation_epilogue(ptr, sizeof(T), k);
+
+        for (std::size_t j = i; j < i + k; j++) {
+          using tuple_type = std::decay_t<decltype(init_fn(j))>;
+          construct(res[j].as_bare_pointer(), tok, init_fn(j),
+                    std::make_index_sequence<std::tuple_size<tuple_type>::value>{});
+        }
+      }
+      return res;
+    }
   };
   template <typename T>
   class gc_allocator__<gc_array<T>> {
@@ -161,6 +221,19 @@ namespace mpgc {
     gc_allocator__<T> a;
     return a.allocate(std::forward<Args>(args)...);
   }
+  /*
+   * Allocate n objects of type T in one go. The i-th object is constructed
+   * with the arguments in the tuple returned by init_fn(i), e.g.
+   *   make_gc_batch<User>(n, [&](std::size_t i) { return std::make_tuple(names[i]); });
+   * The objects are returned in an array, in order.
+   */
+  template <typename T, typename Fn>
+  inline
+  gc_array_ptr<gc_ptr<T>> make_gc_batch(std::size_t n, Fn &&init_fn) {
+    if (n == 0) { return nullptr; }
+    gc_allocator__<T> a;
+    return a.allocate_batch(n, std::forward<Fn>(init_fn));
+  }
   template <typename T>
   inline
   gc_ptr<gc_array<T>> make_gc_array(std::size_t n) {
@@ -48,6 +48,7 @@ namespace mpgc {
     gc_descriptor _descriptor;
 
     friend void allocation_epilogue(void*, gc_token&, std::size_t);
+    friend void batch_allocation_install(void*, gc_token&, std::size_t, std::size_t);
     protected:
     /*
      * By requiring a gc_token parameter, we ensure that
@@ -39,14 +39,57 @@
 #include "ruts/atomic16B.h"
 #include "ruts/managed.h"
 
+/* Number of bits (after the most significant one) of a chunk's size used
+ * to pick its global list, i.e. there are 2^MPGC_SIZE_CLASS_LOG_BITS lists
+ * per power of two. 0 gives the plain power-of-two lists. All the processes
+ * sharing a heap must be built with the same value.
+ */
+#ifndef MPGC_SIZE_CLASS_LOG_BITS
+#define MPGC_SIZE_CLASS_LOG_BITS 2
+#endif
+
+/* Number of shards every global list is split into, to spread the CAS
+ * traffic on the list heads. A thread allocates from the shard of the CPU
+ * it runs on and steals from the others only when that one runs dry.
+ * Same as above, it must match across the processes sharing a heap.
+ */
+#ifndef MPGC_GLOBAL_LIST_SHARDS
+#define MPGC_GLOBAL_LIST_SHARDS 4
+#endif
+
 namespace mpgc {
   /* The main allocator class. */
   class gc_allocator {
   private:
-   constexpr static uint8_t global_list_max_size = 48;
-   constexpr static std::size_t slab_size = 4096;
+   constexpr static uint8_t size_class_log_bits = MPGC_SIZE_CLASS_LOG_BITS;
+   static_assert(size_class_log_bits <= 2, "global list index must fit in uint8_t");
+   constexpr static uint8_t global_list_max_size = 48 << size_class_log_bits;
+   constexpr static uint8_t global_list_shards = MPGC_GLOBAL_LIST_SHARDS;
+   static_assert(global_list_shards > 0, "need at least one shard");
+   /* Small requests carve a slab at least this big off a global chunk, and
+    * the local allocator serves the following requests out of it.
+    */
+   constexpr static std::size_t min_slab_size = 4096;
+   constexpr static std::size_t default_max_slab_size = 64 << 10;
+   constexpr static std::size_t large_object_table_size = 4096;
+   /* Requests of at least this size look at a few more chunks in the first
+    * list before moving on to the bigger lists, so that a big chunk isn't
+    * split when there is one that fits better.
+    */
+   constexpr static std::size_t best_fit_min_size = 1 << 20;
+   constexpr static uint8_t best_fit_probe_count = 8;
 
   public:
+   constexpr static std::size_t page_size = 4096;
+   /* Requests of at least this size are allocated page-aligned, bypassing
+    * the local allocator, and are tracked in the large object table.
+    */
+   constexpr static std::size_t large_object_min_size = 64 << 10;
+   /* Large objects of at least this size only clear the parts of their
+    * pages that aren't holes in the heap file. See zero_fill().
+    */
+   constexpr static std::size_t hole_check_min_size = 1 << 20;
+
     /* TODO: In future we should make chunks inherit from gc_allocated, once we have support
      * for free blobs in gc_descriptors. This way, during sweep, fetching object_size() would
      * work for any object/blob on the heap.
@@ -99,7 +142,111 @@ namespace mpgc {
     using localPoolType = std::map<std::size_t, local_chunk*>;
 
     using atomicSizedChunkType = ruts::atomic16B<list_head>;
-    using globalListType = atomicSizedChunkType[global_list_max_size];
+    using shardListType = atomicSizedChunkType[global_list_max_size];
+    using globalListType = shardListType[global_list_shards];
+
+    /* Used by sweep to collect free chunks into per size-class runs, which
+     * are then spliced into the global list with a single CAS each. Sweep
+     * discovers free chunks in address order, so each run (one logical
+     * chunk's worth) is address ordered, which keeps consecutive
+     * allocations close to each other. The lists as a whole are not: every
+     * run is spliced at the head, so a thread's runs end up in descending
+     * chunk order, interleaved with other threads' runs. Successive runs go
+     * to the shards in round-robin order.
+     *
+     * The chunks in a batch are not reachable from anywhere else until
+     * flushed. If the process dies before that, they are simply found
+     * again by the next sweep.
+     */
+    class chunk_batch {
+      struct run {
+        offset_ptr<global_chunk> head;
+        offset_ptr<global_chunk> tail;
+        run() : head(nullptr), tail(nullptr) {}
+      };
+      run _runs[global_list_max_size];
+      uint8_t _shard;
+
+     public:
+      chunk_batch() : _shard(home_shard()) {}
+
+      void add(const std::size_t size, offset_ptr<global_chunk> c) {
+        assert(size >= sizeof(global_chunk));
+        run &r = _runs[global_list_index_for(size)];
+        if (r.tail) {
+          r.tail->set_next(c);
+        } else {
+          r.head = c;
+        }
+        r.tail = c;
+      }
+
+      void flush(globalListType&);
+    };
+
+    /* Side table of the large objects. They live in the same heap, but as
+     * they are page-aligned and bypass the local allocator, all the pages
+     * they cover except the last one are theirs alone. Sweep looks up the
+     * dead ones here and gives those pages back. Every entry carries the
+     * index of the global list it was allocated under, so that the objects
+     * allocated after the sweep flip are left alone. If the table is full,
+     * a large object is simply not tracked.
+     *
+     * Entries also carry the GC cycle they were allocated or last carried
+     * over in (in the bits below the page offset, so modulo 1024). A valid
+     * entry swept in cycle N is stamped N-1 or N. Anything older was
+     * missed by a sweep that never finished (all GC threads died or exited
+     * half way), and its memory may have been handed out again since, so
+     * it is dropped without being looked at.
+     */
+    class large_object_table {
+      constexpr static std::size_t idx_bit = 0x1;
+      constexpr static std::size_t used_bit = 0x2;
+      constexpr static std::size_t stamp_shift = 2;
+      constexpr static std::size_t stamp_mask = (page_size - 1) & ~(idx_bit | used_bit);
+      std::atomic<std::size_t> _entries[large_object_table_size];
+      std::atomic<std::size_t> _hint;
+
+     public:
+      large_object_table() : _hint(0) {
+        for (std::atomic<std::size_t> &e : _entries) {
+          e.store(0);
+        }
+      }
+
+      static constexpr std::size_t stamp_for(const std::size_t cycle) {
+        return (cycle << stamp_shift) & stamp_mask;
+      }
+
+      bool insert(const uint8_t*, const uint8_t, const std::size_t);
+
+      /* Goes over the entries allocated under idx, in GC cycle `cycle`. The
+       * ones for which is_live() is true are moved over to the other index,
+       * the rest are dropped and handed to release(). With several GC
+       * threads doing this at once, every entry is handled by exactly one
+       * of them.
+       */
+      template <typename LiveFn, typename ReleaseFn>
+      void sweep(const uint8_t idx, const std::size_t cycle, LiveFn &&is_live, ReleaseFn &&release) {
+        for (std::atomic<std::size_t> &e : _entries) {
+          std::size_t v = e.load();
+          if (!(v & used_bit) || (v & idx_bit) != idx) {
+            continue;
+          }
+          const std::size_t age = (stamp_for(cycle) - (v & stamp_mask)) & stamp_mask;
+          if (age > stamp_for(1)) {
+            e.compare_exchange_strong(v, 0);
+            continue;
+          }
+          const offset_ptr<const gc_allocated> p(reinterpret_cast<const gc_allocated*>(base_offset_ptr::base() + (v & ~(page_size - 1))));
+          if (is_live(p)) {
+            e.compare_exchange_strong(v, ((v ^ idx_bit) & ~stamp_mask) | stamp_for(cycle));
+          } else if (e.compare_exchange_strong(v, 0)) {
+            release(p);
+          }
+        }
+      }
+    };
 
    private:
     constexpr static std::size_t bits_in_word() {
@@ -114,44 +261,101 @@ namespace mpgc {
       return __builtin_ctzl(sizeof(global_chunk)) + 1;
     }
 
-    static void _put_to_global(globalListType&, const std::size_t, offset_ptr<global_chunk>);
-    static offset_ptr<global_chunk> _get_from_global(globalListType&, const std::size_t, const std::size_t);
+    static void _splice_to_global(shardListType&, const std::size_t, offset_ptr<global_chunk>, offset_ptr<global_chunk>);
+    static void _put_to_global(shardListType &list, const std::size_t idx, offset_ptr<global_chunk> c) {
+      _splice_to_global(list, idx, c, c);
+    }
+    static offset_ptr<global_chunk> _get_fitting_chunk(shardListType&, const std::size_t, const std::size_t);
+    static offset_ptr<global_chunk> _get_from_global(shardListType&, const std::size_t, const std::size_t, const std::size_t);
+    static uint8_t home_shard();
     static offset_ptr<global_chunk> get_from_global(const std::size_t);
+    static void put_to_local(localPoolType&, uint8_t*, const std::size_t);
+    static void zero_fill(uint8_t*, uint8_t*);
+    static void* alloc_large(std::size_t);
     static bool keep_iterating(std::size_t);
 
    public:
+    /* The index of the power of two is followed by size_class_log_bits
+     * of the size right after its most significant bit.
+     */
     constexpr static inline std::size_t global_list_index_for(std::size_t size) {
-      return bits_in_word() - __builtin_clzl(size) - global_chunk_log_bits();
+      return ((bits_in_word() - __builtin_clzl(size) - global_chunk_log_bits()) << size_class_log_bits)
+             | ((size >> (bits_in_word() - 1 - __builtin_clzl(size) - size_class_log_bits))
+                & ((std::size_t(1) << size_class_log_bits) - 1));
     }
 
+    //Smallest chunk size that goes to list at index.
     constexpr static inline std::size_t index_to_size(std::size_t index) {
-      return 1 << (index + global_chunk_log_bits() - 1);
+      return ((std::size_t(1) << size_class_log_bits) | (index & ((std::size_t(1) << size_class_log_bits) - 1)))
+             << ((index >> size_class_log_bits) + global_chunk_log_bits() - 1 - size_class_log_bits);
     }
 
     constexpr static inline std::size_t align_size_up(std::size_t size, std::size_t alignment) {
       return (size + (alignment - 1)) & ~(alignment - 1);
     }
-    static void initialize(std::size_t s, globalListType *lists) {
+    static bool release_pages(uint8_t*, uint8_t*);
+    static void initialize(std::size_t s, globalListType *lists, large_object_table *large_objects, const int heap_fd = -1) {
       _global_list_size = global_list_index_for(s) + 1;
       assert(_global_list_size <= global_list_max_size);
 
       global_free_lists = lists;
+      _large_objects = large_objects;
+      _heap_fd = heap_fd;
     }
-    static void put_to_global(globalListType& list, const std::size_t size, offset_ptr<global_chunk> c) {
+    static void put_to_global(shardListType& list, const std::size_t size, offset_ptr<global_chunk> c) {
       assert(size >= sizeof(global_chunk));
       _put_to_global(list, global_list_index_for(size), c);
     }
 
-    static offset_ptr<global_chunk> get_chunk_from_global(globalListType&, const std::size_t);
+    static offset_ptr<global_chunk> get_chunk_from_global(shardListType&, const std::size_t);
+
+    struct free_list_stats {
+      std::size_t n_chunks = 0;
+      std::size_t bytes = 0;
+      std::size_t largest = 0;
+    };
+
+    /* Walks the global list currently used for allocation. The lists keep
+     * changing underneath, so this is only a rough snapshot, meant for tools
+     * and benchmarks. Don't call it from anywhere that matters.
+     */
+    static free_list_stats current_free_list_stats();
 
     static const uint8_t global_list_size() {
       return _global_list_size;
     }
 
+    /* Per-thread state of the slab carving. Every trip to the global list
+     * for a small request doubles the slab the thread carves next time, up
+     * to max_slab_size(), and every sweep halves it again. A thread that
+     * keeps allocating therefore goes to the global list less and less often.
+     */
+    struct thread_alloc_state {
+      std::size_t slab_size = min_slab_size;
+      std::size_t global_trips = 0;
+      std::size_t global_bytes = 0;
+
+      void grow() {
+        slab_size = std::min(slab_size * 2, max_slab_size());
+      }
+      void shrink() {
+        slab_size = slab_size / 2 > min_slab_size ? slab_size / 2 : min_slab_size;
+      }
+    };
+
+    /* The cap on the adaptive slab size, taken from ${MPGC_MAX_SLAB_SIZE}
+     * (in bytes). Setting it to 4096 turns the adaptation off.
+     */
+    static std::size_t max_slab_size();
+    static thread_alloc_state current_thread_alloc_state();
+
     static void* alloc (std::size_t);
    private:
 
     static globalListType *global_free_lists;
+    static large_object_table *_large_objects;
+    //Kept open to look for holes in the heap file, -1 if we can't.
+    static int _heap_fd;
     static uint8_t _global_list_size;
   };
 
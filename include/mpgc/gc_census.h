@@ -0,0 +1,258 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#ifndef GC_CENSUS_H_
+#define GC_CENSUS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+namespace mpgc {
+  /*
+   * Live bytes and objects by type descriptor, counted by the GC threads as
+   * they mark objects black on every census_every()-th cycle. Descriptors
+   * are keyed by gc_descriptor::type_key(), so compact descriptors with the
+   * same layout share an entry (see is_shared()), and external ones are
+   * keyed by their address.
+   *
+   * Like gc_mem_stats, counts are folded into counting(cycle) before sweep2
+   * ends and copied to stable() when the cycle number is bumped. There are
+   * two counting tables, used by alternate cycles, so that a process that
+   * is already counting the next cycle doesn't lose its counts when the
+   * table of the last one is cleared. Objects allocated during a census
+   * cycle are not marked by the GC threads, so they only show up in the
+   * next census. If a process dies in the middle of a census cycle,
+   * whatever it had counted is lost.
+   */
+  class heap_census {
+   public:
+    constexpr static std::size_t n_entries = 8192;
+    constexpr static std::size_t n_names = 4096;
+    constexpr static std::size_t max_name_length = 119;
+
+    struct entry {
+      //0 means empty. No valid descriptor is all zeros.
+      std::atomic<std::uint64_t> key;
+      std::atomic<std::uint64_t> bytes;
+      std::atomic<std::uint64_t> objects;
+    };
+
+    class table {
+      entry _entries[n_entries];
+      //Counts that didn't fit in the table.
+      entry _other;
+
+     public:
+      table() {
+        clear();
+      }
+
+      void add(std::uint64_t key, std::uint64_t bytes, std::uint64_t objects) {
+        for (std::size_t i = 0, slot = hash(key); i < n_entries; i++, slot = (slot + 1) % n_entries) {
+          entry &e = _entries[slot];
+          std::uint64_t k = e.key.load(std::memory_order_relaxed);
+          if (k == 0 && e.key.compare_exchange_strong(k, key)) {
+            k = key;
+          }
+          if (k == key) {
+            e.bytes.fetch_add(bytes, std::memory_order_relaxed);
+            e.objects.fetch_add(objects, std::memory_order_relaxed);
+            return;
+          }
+        }
+        _other.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        _other.objects.fetch_add(objects, std::memory_order_relaxed);
+      }
+
+      void clear() {
+        for (entry &e : _entries) {
+          e.key = 0;
+          e.bytes = 0;
+          e.objects = 0;
+        }
+        _other.key = 0;
+        _other.bytes = 0;
+        _other.objects = 0;
+      }
+
+      //Calls fn(key, bytes, objects) for every descriptor seen, and with a
+      //key of 0 for the ones that didn't fit.
+      template <typename Fn>
+      void for_each(Fn&& fn) const {
+        for (const entry &e : _entries) {
+          if (e.key != 0) {
+            fn(e.key.load(), e.bytes.load(), e.objects.load());
+          }
+        }
+        if (_other.objects != 0) {
+          fn(std::uint64_t(0), _other.bytes.load(), _other.objects.load());
+        }
+      }
+
+      void copy_from(const table &other) {
+        clear();
+        other.for_each([this](std::uint64_t key, std::uint64_t bytes, std::uint64_t objects) {
+            if (key == 0) {
+              _other.bytes = bytes;
+              _other.objects = objects;
+            } else {
+              add(key, bytes, objects);
+            }
+          });
+      }
+    };
+
+    static std::size_t hash(std::uint64_t key) {
+      return (key * 0x9E3779B97F4A7C15ull) >> 51;
+    }
+
+   private:
+    struct name_entry {
+      std::atomic<std::uint64_t> key;
+      std::atomic<bool> ready;
+      //Set when a type with a different name registers the same key.
+      std::atomic<bool> shared;
+      char name[max_name_length + 1];
+    };
+
+    std::atomic<std::size_t> _every;
+    //Both are one more than the cycle number, so that 0 means none.
+    std::atomic<std::size_t> _stable_cycle;
+    std::atomic<std::size_t> _publishing_cycle;
+    table _counting[2];
+    table _stable;
+    name_entry _names[n_names];
+
+   public:
+    heap_census() : _every(0), _stable_cycle(0), _publishing_cycle(0) {
+      for (name_entry &n : _names) {
+        n.key = 0;
+        n.ready = false;
+        n.shared = false;
+      }
+    }
+
+    //0 turns the census off.
+    std::size_t census_every() const {
+      return _every;
+    }
+    void set_census_every(std::size_t n) {
+      _every = n;
+    }
+    bool due(std::size_t cycle) const {
+      const std::size_t n = census_every();
+      return n != 0 && cycle % n == 0;
+    }
+
+    //The table the counts of the given cycle go to.
+    table &counting(std::size_t cycle) {
+      return _counting[cycle & 1];
+    }
+    const table &stable() const {
+      return _stable;
+    }
+    //Has a census been completed yet?
+    bool has_stable() const {
+      return _stable_cycle != 0;
+    }
+    //The cycle stable() was counted in.
+    std::size_t stable_cycle() const {
+      return _stable_cycle - 1;
+    }
+
+    /* Called by every GC thread that took part in a census once the cycle
+     * number has been bumped past it. Only the first one to get here does
+     * the copy. The table is cleared right away, since the cycle that
+     * filled it is over, and the next cycle to use it can't start before
+     * this GC thread has gone through the barriers of the one in between.
+     */
+    void publish(std::size_t cycle) {
+      std::size_t last = _publishing_cycle;
+      if (last >= cycle + 1 || !_publishing_cycle.compare_exchange_strong(last, cycle + 1)) {
+        return;
+      }
+      _stable_cycle = 0;
+      _stable.copy_from(counting(cycle));
+      counting(cycle).clear();
+      _stable_cycle = cycle + 1;
+    }
+
+    /* Remembers the type name for a descriptor key. The first name
+     * registered wins, and if another type registers the same key, the key
+     * is marked as shared.
+     */
+    void note_name(std::uint64_t key, const char *name) {
+      for (std::size_t i = 0, slot = hash(key) % n_names; i < n_names; i++, slot = (slot + 1) % n_names) {
+        name_entry &n = _names[slot];
+        std::uint64_t k = n.key.load();
+        if (k == 0 && n.key.compare_exchange_strong(k, key)) {
+          std::strncpy(n.name, name, max_name_length);
+          n.name[max_name_length] = '\0';
+          n.ready = true;
+          return;
+        } else if (k == key) {
+          while (!n.ready) {
+          }
+          if (std::strncmp(n.name, name, max_name_length) != 0) {
+            n.shared = true;
+          }
+          return;
+        }
+      }
+    }
+
+    //Do objects of more than one type have this key?
+    bool is_shared(std::uint64_t key) const {
+      for (std::size_t i = 0, slot = hash(key) % n_names; i < n_names; i++, slot = (slot + 1) % n_names) {
+        const name_entry &n = _names[slot];
+        const std::uint64_t k = n.key.load();
+        if (k == 0) {
+          return false;
+        } else if (k == key) {
+          return n.shared;
+        }
+      }
+      return false;
+    }
+
+    //The (mangled) type name registered for the key, or nullptr.
+    const char *name_of(std::uint64_t key) const {
+      for (std::size_t i = 0, slot = hash(key) % n_names; i < n_names; i++, slot = (slot + 1) % n_names) {
+        const name_entry &n = _names[slot];
+        const std::uint64_t k = n.key.load();
+        if (k == 0) {
+          return nullptr;
+        } else if (k == key) {
+          return n.ready ? n.name : nullptr;
+        }
+      }
+      return nullptr;
+    }
+  };
+}
+
+#endif /* GC_CENSUS_H_ */
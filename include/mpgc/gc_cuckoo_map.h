@@ -34,6 +34,8 @@
 #ifndef GC_CUCKOO_MAP_H_
 #define GC_CUCKOO_MAP_H_
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <random>
 #include <atomic>
@@ -41,17 +43,218 @@
 #include <utility>
 #include <cassert>
 #include <random>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "mpgc/gc.h"
 #include "ruts/bit_field.h"
 #include "ruts/meta.h"
 #include "ruts/hashes.h"
 #include "ruts/cas_loop.h"
+#include "ruts/util.h"
 
 namespace mpgc {
 
   template <std::size_t Cap, std::size_t Bits, std::size_t Size, typename Enable = void> struct __bits_needed;
 
+  /*
+   * A process-local thread that finishes segment migrations that nobody's
+   * stepping on.  (It can't be the GC thread, since that isn't a mutator
+   * and doesn't go through write barriers.)  Each task does a bounded step
+   * and says whether it's done.  Unfinished ones go to the back of the line.
+   *
+   * It only runs between start() and stop(), for programs that ask for it.
+   * Otherwise the operations that run into a growing segment finish it, a
+   * batch at a time.  The thread is a mutator, so it should be stopped
+   * before the process is done with the heap.  If it isn't, it's stopped
+   * at exit.
+   */
+  class background_migrator {
+    // Held across the whole of start() and stop(), so that a start can't
+    // sneak in while a stopping thread is being joined.
+    std::mutex _control;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::function<bool()>> _tasks;
+    std::thread _thread;
+    bool _stopping = false;
+    std::atomic<bool> _running{false};
+
+    void run() {
+      initialize_thread();
+      std::unique_lock<std::mutex> lk(_mutex);
+      while (true) {
+        _cv.wait(lk, [this]{ return _stopping || !_tasks.empty(); });
+        if (_stopping) {
+          return;
+        }
+        std::function<bool()> task = std::move(_tasks.front());
+        _tasks.pop_front();
+        lk.unlock();
+        bool done = task();
+        lk.lock();
+        if (!done) {
+          _tasks.push_back(std::move(task));
+        }
+      }
+    }
+
+    void halt() {
+      std::lock_guard<std::mutex> ctl(_control);
+      {
+        std::lock_guard<std::mutex> lk(_mutex);
+        _running = false;
+        _stopping = true;
+        // The migrations get finished by whoever runs into them.
+        _tasks.clear();
+      }
+      _cv.notify_all();
+      if (_thread.joinable()) {
+        _thread.join();
+      }
+    }
+
+    static background_migrator &instance() {
+      static background_migrator m;
+      return m;
+    }
+
+    background_migrator() = default;
+  public:
+    ~background_migrator() {
+      halt();
+    }
+
+    static void start() {
+      background_migrator &m = instance();
+      std::lock_guard<std::mutex> ctl(m._control);
+      if (m._thread.joinable()) {
+        return;
+      }
+      m._stopping = false;
+      m._thread = std::thread([&m]{ m.run(); });
+      m._running = true;
+    }
+
+    static void stop() {
+      instance().halt();
+    }
+
+    static bool running() {
+      return instance()._running;
+    }
+
+    // Dropped if the thread isn't running.
+    static void submit(std::function<bool()> task) {
+      background_migrator &m = instance();
+      {
+        std::lock_guard<std::mutex> lk(m._mutex);
+        if (!m._running) {
+          return;
+        }
+        m._tasks.push_back(std::move(task));
+      }
+      m._cv.notify_one();
+    }
+  };
+
+  /*
+   * Process-local threads that gc_cuckoo_map::for_each_parallel() runs
+   * its scans on.  They're started the first time they're wanted and
+   * kept, so a scan doesn't pay for creating threads and registering
+   * them with the GC.  Like the background migrator's, they're mutators
+   * and are stopped at exit.
+   *
+   * One scan has the threads at a time.  A scan that finds them taken
+   * (including one started from inside another's fn) just runs on the
+   * calling thread.
+   */
+  class scan_pool {
+    std::mutex _run_mutex;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::condition_variable _done_cv;
+    std::vector<std::thread> _threads;
+    const std::function<void()> *_job = nullptr;
+    // Pool threads yet to pick up the job, and ones still in it.
+    unsigned _wanted = 0;
+    unsigned _busy = 0;
+    bool _stopping = false;
+
+    void work() {
+      initialize_thread();
+      std::unique_lock<std::mutex> lk(_mutex);
+      while (true) {
+        _cv.wait(lk, [this]{ return _stopping || _wanted > 0; });
+        if (_stopping) {
+          return;
+        }
+        _wanted--;
+        _busy++;
+        const std::function<void()> &job = *_job;
+        lk.unlock();
+        job();
+        lk.lock();
+        if (--_busy == 0) {
+          _done_cv.notify_all();
+        }
+      }
+    }
+
+    static scan_pool &instance() {
+      static scan_pool p;
+      return p;
+    }
+
+    scan_pool() = default;
+  public:
+    ~scan_pool() {
+      {
+        std::lock_guard<std::mutex> lk(_mutex);
+        _stopping = true;
+      }
+      _cv.notify_all();
+      for (std::thread &t : _threads) {
+        t.join();
+      }
+    }
+
+    /*
+     * Calls job() on this thread and up to n-1 pool threads, and returns
+     * once they've all returned.  job() has to be fine with being called
+     * any number of times, some of them after the work has run out.
+     */
+    static void run(unsigned n, const std::function<void()> &job) {
+      scan_pool &p = instance();
+      std::unique_lock<std::mutex> turn(p._run_mutex, std::try_to_lock);
+      if (n <= 1 || !turn.owns_lock()) {
+        job();
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lk(p._mutex);
+        while (p._threads.size() < n - 1) {
+          p._threads.emplace_back([&p]{ p.work(); });
+        }
+        p._job = &job;
+        p._wanted = n - 1;
+      }
+      p._cv.notify_all();
+      job();
+      std::unique_lock<std::mutex> lk(p._mutex);
+      // Once we're back, the work's all been handed out, so threads that
+      // haven't woken up yet needn't bother.
+      p._wanted = 0;
+      p._done_cv.wait(lk, [&p]{ return p._busy == 0; });
+      p._job = nullptr;
+    }
+  };
+
   template <typename K, typename V, typename Hash1=ruts::hash1<K>, typename Hash2=ruts::hash2<K>,
       std::size_t SegBits = 10>
   class gc_cuckoo_map : public gc_allocated {
@@ -97,6 +300,12 @@ namespace mpgc {
     constexpr static std::size_t default_initial_segment_bits = 10;
     constexpr static std::size_t max_segment_slot_bits = 64-n_seg_bits;
     constexpr static std::size_t default_cap = 1 << (n_seg_bits + default_initial_segment_bits);
+    // How many keys find_batch() has in flight at once.
+    constexpr static std::size_t batch_size = 16;
+    // How many slots an operation that runs into a growing segment migrates
+    // on its way through, and how many the background thread does per step.
+    constexpr static std::size_t migrate_batch = 64;
+    constexpr static std::size_t background_migrate_batch = 4096;
 
     enum class side { LEFT, RIGHT };
 
@@ -193,6 +402,8 @@ namespace mpgc {
       gc_array_ptr<atomic_entry_ptr_type> _slots{_size};
       std::atomic<gc_ptr<segment>> _replacement{nullptr};
       mutable std::atomic<std::size_t> _next_to_migrate{0};
+      // The segment we're the replacement for, until we're installed.
+      std::atomic<gc_ptr<segment>> _source{nullptr};
 
       friend class table;
       friend class gc_cuckoo_map;
@@ -201,20 +412,20 @@ namespace mpgc {
         return hash & _mask;
       }
 
-      slot_ref slot(hash_type hash) {
+      slot_ref slot_at(hash_type hash) {
         std::size_t i = slot_index(hash);
         return slot_ref(GC_THIS, i, _slots[i]);
       }
-      slot_const_ref slot(hash_type hash) const {
+      slot_const_ref slot_at(hash_type hash) const {
         std::size_t i = slot_index(hash);
         return slot_const_ref(GC_THIS, i, _slots[i]);
       }
 
       slot_ref slot(const key_type &key) {
-        return slot(_hash(key));
+        return slot_at(_hash(key));
       }
       slot_const_ref slot(const key_type &key) const {
-        return slot(_hash(key));
+        return slot_at(_hash(key));
       }
 
 
@@ -226,7 +437,7 @@ namespace mpgc {
       }
 
       bool replace_null(const gc_ptr<entry_type> &with, hash_type hash) {
-        atomic_entry_ptr_type &s = *slot(hash);
+        atomic_entry_ptr_type &s = *slot_at(hash);
 
         auto guard = [=](const entry_ptr_type &ep) {
           return ep == nullptr && !ep[frozen];
@@ -244,7 +455,7 @@ namespace mpgc {
         if (ur) {
           return true;
         } else if (ur.prior_value[frozen]) {
-          gc_ptr<segment> new_seg = help_with_grow();
+          gc_ptr<segment> new_seg = forward(slot_index(hash));
           return new_seg->replace_null(with, hash);
         } else {
           return false;
@@ -306,7 +517,7 @@ namespace mpgc {
         if (!ur) {
           // not empty or frozen.
           if (ur.prior_value[frozen]) {
-            gc_ptr<segment> new_seg = help_with_grow();
+            gc_ptr<segment> new_seg = forward(target.index);
             // Find the new target slot (and communicate it back to the caller)
             target = new_seg->slot(current->key);
             return new_seg->accept_move(source, current, target);
@@ -344,7 +555,7 @@ namespace mpgc {
             break;
           } else if (ur2.prior_value[frozen]) {
             // The segment grew, so we need to reestablish the target
-            gc_ptr<segment> new_seg = help_with_grow();
+            gc_ptr<segment> new_seg = target.seg->forward(target.index);
             target = new_seg->slot(current->key);
           } else {
             return false;
@@ -357,53 +568,97 @@ namespace mpgc {
       }
 
 
+      /*
+       * Growing used to migrate the whole segment in whichever operation
+       * hit it first.  Now grow() and every operation that runs into a
+       * frozen slot only move a bounded batch (after the slot they need),
+       * and the background migrator, if it was started, drains the rest.
+       * Until the last slot is moved, the old segment stays installed, and
+       * a frozen slot in it just means "look in _replacement".  That's safe
+       * because the only source for slot j in the replacement is slot
+       * (j & _mask) here.
+       */
       void grow(std::size_t by) {
-        gc_ptr<segment> new_seg = make_gc<segment>(GC_THIS, by);
-        if (!ruts::try_change_value(_replacement, nullptr, new_seg)) {
-          // Somebody else got there first.  That's okay.
+        // If we're a replacement that hasn't been installed yet, our source
+        // may still be copying into us, so it has to finish before we can
+        // start freezing slots.  Rather than finish it all here, help with
+        // a batch and let the caller retry, which will get here again if
+        // we're still too full.
+        gc_ptr<segment> src = _source;
+        if (src != nullptr && src->help_migrate(migrate_batch) == nullptr) {
+          return;
+        }
+        if (_replacement.load() == nullptr) {
+          gc_ptr<segment> new_seg = make_gc<segment>(GC_THIS, by);
+          if (!ruts::try_change_value(_replacement, nullptr, new_seg)) {
+            // Somebody else got there first.  That's okay.
+          }
+        }
+        if (help_migrate(migrate_batch) == nullptr && background_migrator::running()) {
+          external_gc_ptr<segment> self = GC_THIS;
+          background_migrator::submit([self] {
+              return self->help_migrate(background_migrate_batch) != nullptr;
+            });
         }
-        help_with_grow();
         // At the end it will be installed.
       }
 
-      gc_ptr<segment> help_with_grow() const {
+      /*
+       * Freezes slot i and copies what was there into the replacement.  Any
+       * number of threads can do this for the same slot.
+       */
+      void migrate_slot(std::size_t i, const gc_ptr<segment> &r) const {
+        // We're okay with casting away constness to freeze the slot.
+        atomic_entry_ptr_type &slot = const_cast<segment *>(this)->_slots[i];
+        auto ur = slot.template set_flag(frozen);
+        // We may not have been the first one to freeze it, but we can't assume that
+        // the one who did succeeded in copying it.
+        entry_ptr_type ep = ur.new_value;
+        gc_ptr<entry_type> e = ep;
+        if (e != nullptr) {
+          // Find the slot in the replacement.
+          hash_type h = _hash(e->key);
+          std::size_t j = r->slot_index(h);
+
+          // we want to keep the same version number on the other side, but it needs to
+          // not be frozen.  It's okay if it's moving, since we still want to complete the move.
+
+          // TODO: *Why* do we want to keep the same version number
+          // on the other side?  What's wrong with simply restarting
+          // at one?
+          ep[frozen] = false;
+          // While everybody who's helping with the move will set
+          // the same value, we have to worry about this thread
+          // getting delayed for long enough that not only did the
+          // value get moved by another thread, but the entire grow
+          // finished, and somebody replaced the moved value with
+          // something else.  So we can't just unconditionally move.
+          // So instead we try to replace the initial null with this
+          // value.  If it fails, that means that somebody else did
+          // it.
+          r->_slots[j].change(nullptr, ep);
+        }
+      }
+
+      /*
+       * Migrates up to max_slots more slots.  Returns the installed segment
+       * if the migration is done (whether or not we did the last of it) and
+       * null if there's more to do.
+       */
+      gc_ptr<segment> help_migrate(std::size_t max_slots) const {
         gc_ptr<segment> r = _replacement;
-        segment *nc_this = const_cast<segment *>(this);
-        for (std::size_t i = _next_to_migrate; i < _size; /* update at end */) {
-          // We're okay with casting away constness to freeze the slot.
-          atomic_entry_ptr_type &slot = nc_this->_slots[i];
-          auto ur = slot.template set_flag(frozen);
-          // We may not have been the first one to freeze it, but we can't assume that
-          // the one who did succeeded in copying it.
-          entry_ptr_type ep = ur.new_value;
-          gc_ptr<entry_type> e = ep;
-          if (e != nullptr) {
-            // Find the slot in the replacement.
-            hash_type h = _hash(e->key);
-            std::size_t i = r->slot_index(h);
-
-            // we want to keep the same version number on the other side, but it needs to
-            // not be frozen.  It's okay if it's moving, since we still want to complete the move.
-
-            // TODO: *Why* do we want to keep the same version number
-            // on the other side?  What's wrong with simply restarting
-            // at one?
-            ep[frozen] = false;
-            // While everybody who's helping with the move will set
-            // the same value, we have to worry about this thread
-            // getting delayed for long enough that not only did the
-            // value get moved by another thread, but the entire grow
-            // finished, and somebody replaced the moved value with
-            // something else.  So we can't just unconditionally move.
-            // So instead we try to replace the initial null with this
-            // value.  If it fails, that means that somebody else did
-            // it.
-            r->_slots[i].change(nullptr, ep);
-          }
-	  i = ruts::increment_to_at_least(_next_to_migrate, i+1).resulting_value();
+        std::size_t i = _next_to_migrate;
+        for (std::size_t n = 0; i < _size && n < max_slots; n++) {
+          migrate_slot(i, r);
+          // Only bumped once the slot's been copied, so it's safe to crash anywhere.
+          i = ruts::increment_to_at_least(_next_to_migrate, i+1).resulting_value();
+        }
+        if (i < _size) {
+          return nullptr;
         }
         // Now everything has been moved.  We might be the first to have finished (or the
         // one who was might have died before installing), so we'll try to install.
+        segment *nc_this = const_cast<segment *>(this);
         ruts::cas_loop_return_value<gc_ptr<segment>>
           install_res = ruts::try_change_value(_table->_segments[_num], this_as_gc_ptr(nc_this), r);
         // If that failed, somebody else got there first... and we might even have grown
@@ -411,10 +666,65 @@ namespace mpgc {
         // Even if it succeeded, we can't delete the old one yet, because others are using it.
         // So we'll drop it on the floor for now.  Eventually, we'll probably need to use
         // hazard pointers.
+        r->_source = nullptr;
         // In any case, we return the currently-installed segment.
         return install_res.resulting_value();
       }
 
+      // Finishes the migration, however long it takes.
+      gc_ptr<segment> help_with_grow() const {
+        return help_migrate(_size);
+      }
+
+      /*
+       * Called on seeing slot i frozen.  Makes sure it's been copied, helps
+       * with a batch of the rest, and returns the segment to retry in.
+       */
+      gc_ptr<segment> forward(std::size_t i) const {
+        gc_ptr<segment> r = _replacement;
+        migrate_slot(i, r);
+        help_migrate(migrate_batch);
+        return r;
+      }
+
+      // The slot for hash, following frozen slots into replacements.
+      slot_ref live_slot(hash_type hash) {
+        slot_ref s = slot_at(hash);
+        while (s.contents()[frozen]) {
+          s = s.seg->forward(s.index)->slot_at(hash);
+        }
+        return s;
+      }
+
+      /*
+       * Calls fn(entry) for what's in slot i.  If it's frozen, that's
+       * wherever it went in the replacement (making sure it got there),
+       * which is every slot there that's i modulo our size.
+       */
+      template <typename Fn>
+      void visit_slot(std::size_t i, Fn &fn) const {
+        entry_ptr_type ep = _slots[i].contents();
+        if (ep[frozen]) {
+          gc_ptr<segment> r = _replacement;
+          migrate_slot(i, r);
+          for (std::size_t j = i; j < r->_size; j += _size) {
+            r->visit_slot(j, fn);
+          }
+          return;
+        }
+        gc_ptr<entry_type> e = ep.pointer();
+        if (e != nullptr && !moving(ep)) {
+          fn(e);
+        }
+      }
+
+      template <typename Fn>
+      void visit(Fn &fn) const {
+        for (std::size_t i = 0; i < _size; i++) {
+          visit_slot(i, fn);
+        }
+      }
+
     public:
       segment(gc_token &gc, std::size_t n, std::size_t slot_bits, const gc_ptr<table> &t)
       : gc_allocated{gc},
@@ -429,6 +739,7 @@ namespace mpgc {
                 prior->_slot_bits+plus_bits,
                 prior->_table)
       {
+        _source = prior;
 //        std::cerr << "--- Growing segment " << prior << " (" << prior->_slot_bits << ") "
 //            << "into " << this << " (" << _slot_bits << ")." << std::endl;
       }
@@ -444,14 +755,15 @@ namespace mpgc {
 	  .template WITH_FIELD(&segment::_mask)
 	  .template WITH_FIELD(&segment::_slots)
 	  .template WITH_FIELD(&segment::_replacement)
-	  .template WITH_FIELD(&segment::_next_to_migrate);
+	  .template WITH_FIELD(&segment::_next_to_migrate)
+	  .template WITH_FIELD(&segment::_source);
         return d;
       }
 
       gc_ptr<entry_type> find(const key_type &key, hash_type hash) const {
-        entry_ptr_type current_entry = slot(hash).contents();
+        entry_ptr_type current_entry = slot_at(hash).contents();
         if (current_entry[frozen]) {
-          gc_ptr<segment> new_seg = help_with_grow();
+          gc_ptr<segment> new_seg = forward(slot_index(hash));
           return new_seg->find(key, hash);
         }
         if (matches(key, current_entry)) {
@@ -463,12 +775,21 @@ namespace mpgc {
 
 
 
+      // What's in the slot for hash, without looking at it.
+      gc_ptr<entry_type> occupant(hash_type hash) const {
+        entry_ptr_type current_entry = slot_at(hash).contents();
+        if (current_entry[frozen]) {
+          return forward(slot_index(hash))->occupant(hash);
+        }
+        return current_entry.pointer();
+      }
+
       bool remove(const key_type &key, hash_type hash) {
-        slot_ref s = slot(hash);
+        slot_ref s = slot_at(hash);
 	entry_ptr_type ep = s.contents();
 	while (1) {
 	  if (ep[frozen]) {
-	    gc_ptr<segment> new_seg = help_with_grow();
+	    gc_ptr<segment> new_seg = forward(s.index);
 	    return new_seg->remove(key, hash);
 	  }
 	  gc_ptr<entry_type> e = ep.pointer();
@@ -565,6 +886,12 @@ namespace mpgc {
         return d;
       }
 
+      template <typename Fn>
+      void visit_segment(std::size_t n, Fn &fn) const {
+        gc_ptr<const segment> sp = _segments[n].load();
+        sp->visit(fn);
+      }
+
       gc_ptr<table> other_side() const {
         return _map->other_table(_side);
       }
@@ -572,7 +899,7 @@ namespace mpgc {
       slot_ref slot(const key_type &key) {
         hash_type hash = _hash(key);
         gc_ptr<segment> seg = find_segment(hash);
-        return seg->slot(hash);
+        return seg->live_slot(hash);
       }
 
       gc_ptr<entry_type> find(const key_type &key) const {
@@ -581,6 +908,17 @@ namespace mpgc {
         return seg->find(key, hash);
       }
 
+      /*
+       * Whether key is here, given that e, which holds it, is in the
+       * other table.  Usually settled without touching the entry in our
+       * slot: it's either empty or e itself, mid-eviction.
+       */
+      bool holds(const key_type &key, const gc_ptr<entry_type> &e) const {
+        hash_type hash = _hash(key);
+        gc_ptr<entry_type> here = find_segment(hash)->occupant(hash);
+        return here != nullptr && (here == e || here->key == key);
+      }
+
       bool remove(const key_type &key) {
         hash_type hash = _hash(key);
         gc_ptr<segment> seg = find_segment(hash);
@@ -591,6 +929,38 @@ namespace mpgc {
         gc_ptr<segment> seg = find_segment(hash);
         return seg->replace_null(with, hash);
       }
+
+      /*
+       * find() for keys[which[0..k)], into entries[which[j]].  Each step
+       * of the walk is prefetched for all of them before any is taken,
+       * so the misses overlap.
+       */
+      void find_batch(const key_type *keys, const std::size_t *which, std::size_t k,
+                      gc_ptr<entry_type> *entries) const
+      {
+        hash_type hashes[batch_size];
+        gc_ptr<const segment> segs[batch_size];
+        for (std::size_t j = 0; j < k; j++) {
+          hashes[j] = _hash(keys[which[j]]);
+          __builtin_prefetch(&_segments[left_bit_field(hashes[j], n_seg_bits)]);
+        }
+        for (std::size_t j = 0; j < k; j++) {
+          segs[j] = find_segment(hashes[j]);
+          __builtin_prefetch(segs[j].as_bare_pointer());
+        }
+        for (std::size_t j = 0; j < k; j++) {
+          __builtin_prefetch(segs[j]->slot_at(hashes[j]).slot);
+        }
+        for (std::size_t j = 0; j < k; j++) {
+          gc_ptr<entry_type> e = segs[j]->slot_at(hashes[j]).contents().pointer();
+          if (e != nullptr) {
+            __builtin_prefetch(e.as_bare_pointer());
+          }
+        }
+        for (std::size_t j = 0; j < k; j++) {
+          entries[which[j]] = segs[j]->find(keys[which[j]], hashes[j]);
+        }
+      }
     };
 
     gc_ptr<table> _left_table;
@@ -737,7 +1107,7 @@ namespace mpgc {
         if (ur.prior_value[frozen]) {
           // The slot started growing after we obtained it.  Help it finish and
           // find a new segment.  (It must have the same segment number.)
-          gc_ptr<segment> new_seg = slot.seg->help_with_grow();
+          gc_ptr<segment> new_seg = slot.seg->forward(slot.index);
           slot_ref new_slot = new_seg->slot(key);
           return clear_slot(new_slot, expected, key);
         }
@@ -857,6 +1227,52 @@ namespace mpgc {
       return e == nullptr ? value_type{} : static_cast<value_type>(e->val);
     }
 
+    /*
+     * Looks up keys[0..n), writing the values (value_type{} for missing
+     * keys) to out and, if found isn't null, whether they were there to
+     * found.  Works through the keys batch_size at a time, overlapping
+     * their cache misses, which matters most when the heap is far
+     * away.  Returns the number found.
+     */
+    std::size_t find_batch(const key_type *keys, std::size_t n, value_type *out, bool *found = nullptr) const {
+      std::size_t n_found = 0;
+      for (std::size_t start = 0; start < n; start += batch_size) {
+        const std::size_t m = std::min(batch_size, n - start);
+        gc_ptr<entry_type> entries[batch_size];
+        std::size_t which[batch_size];
+        std::size_t k = m;
+        for (std::size_t i = 0; i < m; i++) {
+          which[i] = i;
+        }
+        _left_table->find_batch(keys + start, which, k, entries);
+        // The ones not on the left go round again on the right.
+        std::size_t missing = 0;
+        for (std::size_t j = 0; j < k; j++) {
+          if (entries[which[j]] == nullptr) {
+            which[missing++] = which[j];
+          }
+        }
+        _right_table->find_batch(keys + start, which, missing, entries);
+        for (std::size_t i = 0; i < m; i++) {
+          const bool there = entries[i] != nullptr;
+          out[start + i] = there ? static_cast<value_type>(entries[i]->val) : value_type{};
+          if (found != nullptr) {
+            found[start + i] = there;
+          }
+          n_found += there;
+        }
+      }
+      return n_found;
+    }
+
+    template <typename ... Keys>
+    std::array<value_type, sizeof...(Keys)> get_many(const Keys & ... keys) const {
+      const key_type ks[] = {keys...};
+      std::array<value_type, sizeof...(Keys)> res;
+      find_batch(ks, sizeof...(Keys), res.data());
+      return res;
+    }
+
     bool remove(const key_type &key) {
       // need to go in reverse order just in case the two tables both
       // temporarily hold values (left shadowing right) with different
@@ -893,6 +1309,94 @@ namespace mpgc {
       return replace_return(clrv, true, clrv.prior_value);
     }
 
+    /*
+     * Iteration is split into parts, one per segment of each table, which
+     * can be visited independently and by different threads.  It's weakly
+     * consistent: entries that are there for the whole scan and stay put
+     * are visited exactly once, whatever the segments do in the meantime
+     * (growing segments are followed into their replacements).  An entry
+     * put or removed during the scan may or may not be seen, and one that
+     * gets evicted to the other table mid-scan can be missed or seen twice.
+     * fn(key, value) mustn't modify the map.
+     */
+    constexpr static std::size_t n_parts() {
+      return n_tables << n_seg_bits;
+    }
+
+    template <typename Fn>
+    void for_each_in_part(std::size_t part, Fn &&fn) const {
+      const std::size_t n_segments = std::size_t{1} << n_seg_bits;
+      if (part < n_segments) {
+        auto visit = [&fn](const gc_ptr<entry_type> &e) {
+          fn(e->key, e->val.load());
+        };
+        _left_table->visit_segment(part, visit);
+      } else {
+        // The left shadows the right, so we skip keys that are also there.
+        auto unshadowed = [this, &fn](const gc_ptr<entry_type> &e) {
+          if (!_left_table->holds(e->key, e)) {
+            fn(e->key, e->val.load());
+          }
+        };
+        _right_table->visit_segment(part - n_segments, unshadowed);
+      }
+    }
+
+    template <typename Fn>
+    void for_each(Fn &&fn) const {
+      for (std::size_t p = 0; p < n_parts(); p++) {
+        for_each_in_part(p, fn);
+      }
+    }
+
+    /*
+     * for_each() with the parts handed out to whatever threads exec puts
+     * on the job, so fn has to be thread-safe.  exec(job) has to call
+     * job() (a std::function<void()>) on any number of threads and return
+     * once they've all returned.  If fn throws, the rest of the parts are
+     * abandoned and the first exception is rethrown here once all the
+     * threads are done.
+     */
+    template <typename Exec, typename Fn>
+    void for_each_parallel_on(Exec &&exec, Fn &&fn) const {
+      std::atomic<std::size_t> next{0};
+      std::mutex failure_mutex;
+      std::exception_ptr failure;
+      const std::function<void()> work = [&] {
+        // The executor's threads needn't know about the GC.
+        initialize_thread();
+        try {
+          for (std::size_t p = next++; p < n_parts(); p = next++) {
+            for_each_in_part(p, fn);
+          }
+        } catch (...) {
+          std::lock_guard<std::mutex> lk(failure_mutex);
+          if (failure == nullptr) {
+            failure = std::current_exception();
+          }
+          next = n_parts();
+        }
+      };
+      exec(work);
+      if (failure != nullptr) {
+        std::rethrow_exception(failure);
+      }
+    }
+
+    /*
+     * for_each_parallel_on() the process's scan_pool, with n_threads
+     * threads (this one included).  0 means one per core.
+     */
+    template <typename Fn>
+    void for_each_parallel(Fn &&fn, unsigned n_threads = 0) const {
+      if (n_threads == 0) {
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+      }
+      for_each_parallel_on([n_threads](const std::function<void()> &job) {
+          scan_pool::run(n_threads, job);
+        }, fn);
+    }
+
     class reference {
       gc_ptr<gc_cuckoo_map> _map;
       const key_type _key;
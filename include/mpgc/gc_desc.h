@@ -37,6 +37,7 @@
 #include <cstdint>
 #include <functional>
 #include <type_traits>
+#include <typeinfo>
 #include <utility>
 #include <vector>
 #include <bitset>
@@ -1091,8 +1092,43 @@ namespace mpgc {
     static void trace_desc(rep_type r, const char *type_name) {
       gc_descriptor(direct{}, r).trace(type_name);
     }
+
+    /**
+     * A key identifying the type of the described objects.
+     *
+     * @returns the internal representation with the check bits
+     * cleared, so it's the same for every object with this
+     * descriptor.  (The check bits depend on the object's address.)
+     * Compact descriptors with the same layout have the same key,
+     * which heap_census::is_shared() reports.  External descriptors
+     * are keyed by the address of their external_descriptor.
+     *
+     * The result can be passed to trace_desc().
+     */
+    constexpr std::uint64_t type_key() const {
+      return is_compact() ? check_bits_fld.replace(_rep, 0) : _rep;
+    }
+
+    /**
+     * Call type_key() statically.
+     *
+     * @param r the internal representation (`uint64_t`) of a descriptor
+     */
+    static std::uint64_t type_key_of(rep_type r) {
+      return gc_descriptor(direct{}, r).type_key();
+    }
   };
 
+  /**
+   * Record the name of the type a descriptor was built for, so that
+   * tools can map census keys back to types.
+   *
+   * @param key the descriptor's type_key().
+   * @param type_name the (mangled) name of the type.  It must outlive
+   * the process's attachment to the heap, as `typeid(T).name()` does.
+   */
+  extern void note_descriptor_type(std::uint64_t key, const char *type_name);
+
   /**
    * A reinterpretation of gc_descriptor when it's known not to be an
    * array descriptor.
@@ -1914,6 +1950,7 @@ s   */
       check_coverage<desc_spec_base<T>::template width<T>(), desc_spec_base<T>::template coverage_mask<Fields...>()>();
       collector c;
       gc_descriptor d = c.to_descriptor();
+      note_descriptor_type(d.type_key(), typeid(T).name());
       // d.trace(typeid(T).name());
       return d;
     }
@@ -106,6 +106,7 @@ namespace mpgc {
       };
 
       gc_allocator::localPoolType local_free_list;
+      gc_allocator::thread_alloc_state alloc_state;
       const pthread_t pthread;
       uint8_t * const stack_end;
       mark_buffer<offset_ptr<const gc_allocated>> * const mbuffer;
@@ -116,7 +117,7 @@ namespace mpgc {
       volatile Signum mark_signal_requested;
       volatile bool sweep_signal_disabled;
       volatile bool sweep_signal_requested;
-      volatile bool clear_local_allocator;
+      allocation_counts * const alloc_counts;
 
       static bool is_marked(in_memory_thread_struct *s) { return s->live == Alive::Dead; }
       void mark_dead() {
@@ -132,6 +133,10 @@ namespace mpgc {
         return live == Alive::Dead;
       }
 
+      void count_allocated(std::size_t bytes, std::size_t n) {
+        alloc_counts->count(bytes, n);
+      }
+
       in_memory_thread_struct() :
           pthread(pthread_self()),
           stack_end(compute_stack_addr()),
@@ -143,11 +148,12 @@ namespace mpgc {
           mark_signal_requested(Signum::sigInit),
           sweep_signal_disabled(false),
           sweep_signal_requested(false),
-          clear_local_allocator(false)
+          alloc_counts(process_struct->allocation_counts_list().insert())
       {}
 
       ~in_memory_thread_struct() {
         mbuffer->mark_dead();
+        alloc_counts->mark_dead();
       }
 
     private:
@@ -285,14 +291,17 @@ namespace mpgc {
        * head is accessed.
        */
       std::atomic_thread_fence(std::memory_order_seq_cst);
+      std::uint32_t sent = 0;
       in_memory_thread_struct *h = thread_struct_list.head();
       while (h) {
         if (!h->marked_dead()) {
           //send signal
           pthread_sigqueue(h->pthread, SIGRTMIN, sigval);
+          sent++;
         }
         h = thread_struct_list.next(h);
       }
+      process_struct->trace().record(trace_event::handshake_send, static_cast<uint8_t>(sig), sent);
     }
 
     inline void wait_handshake(Signum sig) {
@@ -0,0 +1,571 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#ifndef GC_INLINE_MAP_H_
+#define GC_INLINE_MAP_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include "mpgc/gc.h"
+#include "ruts/atomic16B.h"
+#include "ruts/bit_field.h"
+#include "ruts/cas_loop.h"
+#include "ruts/hashes.h"
+
+namespace mpgc {
+
+  /*
+   * Whether gc_inline_map can hold K and V: they have to be plain bytes
+   * (no gc_ptrs, as the slots aren't traced) and fit, with a state byte,
+   * in sixteen bytes.
+   */
+  template <typename K, typename V>
+  struct fits_inline_map
+    : std::integral_constant<bool,
+                             std::is_trivially_copyable<K>::value
+                             && std::is_trivially_copyable<V>::value
+                             && sizeof(K) + sizeof(V) < 16>
+  {};
+
+  /*
+   * A concurrent map with the same interface as gc_cuckoo_map, for small
+   * keys and values, that keeps them in the slots rather than in a
+   * separately allocated entry.  So a lookup is one fewer miss and a put
+   * doesn't allocate.
+   *
+   * Each slot is a sixteen-byte word, updated with a double-word CAS,
+   * holding the key, the value and a state byte.  Cuckoo eviction moves
+   * entries between slots, which the boxed map can do because both slots
+   * point to the same entry and so see the same value, but an inline
+   * value could be changed in one copy while the other is being written.
+   * So within a segment the slots are probed linearly instead.  A key
+   * only ever claims the first empty slot on its probe sequence, and a
+   * removed key leaves its key behind as a tombstone that only it can
+   * revive, so two threads can't put the same key in different slots.
+   *
+   * Segments grow as in gc_cuckoo_map: every slot is frozen and copied
+   * (dropping tombstones) into a replacement, which is then installed.
+   * A segment is replaced when three quarters of its slots have been
+   * claimed.  Tombstones count as claimed, so if they're most of that,
+   * the replacement is the same size, and the churn of keys coming and
+   * going doesn't grow the segment; otherwise it's twice the size.
+   */
+  template <typename K, typename V, typename Hash=ruts::hash1<K>, std::size_t SegBits = 10>
+  class gc_inline_map : public gc_allocated {
+    static_assert(fits_inline_map<K,V>::value, "key and value too big or not trivially copyable");
+  public:
+    using key_type = K;
+    using value_type = V;
+    using hash_fn_type = Hash;
+    using hash_type = uint64_t;
+
+  private:
+    constexpr static std::size_t n_seg_bits = SegBits;
+    constexpr static std::size_t n_segments = std::size_t{1} << n_seg_bits;
+    constexpr static std::size_t default_initial_segment_bits = 10;
+    constexpr static std::size_t default_cap = std::size_t{1} << (n_seg_bits + default_initial_segment_bits);
+    constexpr static std::size_t batch_size = 16;
+
+    enum state : std::uint8_t {
+      empty = 0,
+      live = 1,
+      dead = 2,
+      frozen = 0x80
+    };
+
+    // No padding, so the CAS compares exactly what we wrote.
+    struct alignas(16) cell {
+      unsigned char bytes[15];
+      std::uint8_t st;
+
+      key_type key() const {
+        key_type k;
+        std::memcpy(&k, bytes, sizeof(key_type));
+        return k;
+      }
+      value_type value() const {
+        value_type v;
+        std::memcpy(&v, bytes + sizeof(key_type), sizeof(value_type));
+        return v;
+      }
+      bool is_frozen() const {
+        return (st & frozen) != 0;
+      }
+      std::uint8_t status() const {
+        return st & ~frozen;
+      }
+      bool holds(const key_type &k) const {
+        return status() != empty && key() == k;
+      }
+
+      static cell make(const key_type &k, const value_type &v, std::uint8_t s) {
+        cell c{};
+        std::memcpy(c.bytes, &k, sizeof(key_type));
+        std::memcpy(c.bytes + sizeof(key_type), &v, sizeof(value_type));
+        c.st = s;
+        return c;
+      }
+      cell with_status(std::uint8_t s) const {
+        cell c = *this;
+        c.st = s;
+        return c;
+      }
+    };
+    static_assert(sizeof(cell) == 16, "inline map cells must be sixteen bytes");
+    using atomic_cell = ruts::atomic16B<cell>;
+    static_assert(sizeof(atomic_cell) == 16 && alignof(atomic_cell) == 16,
+                  "inline map cells must be sixteen-byte aligned sixteen-byte words");
+    constexpr static std::size_t cell_words = sizeof(atomic_cell) / sizeof(std::uint64_t);
+
+    class segment;
+    using atomic_seg_ptr = std::atomic<gc_ptr<segment>>;
+    using segments_type = gc_array_ptr<atomic_seg_ptr>;
+
+    /*
+     * Where a key is, or the first empty slot it would go in, in a
+     * segment.  If frozen is set, the segment is growing and the caller
+     * has to go to the replacement.
+     */
+    struct probe_result {
+      std::size_t index = 0;
+      cell contents{};
+      bool found = false;
+      bool frozen = false;
+      bool full = false;
+    };
+
+    class segment : public gc_allocated {
+      const std::size_t _num;
+      const segments_type _segments;
+      const hash_fn_type _hash;
+      const std::size_t _slot_bits;
+      const std::size_t _size = (std::size_t{1} << _slot_bits);
+      const std::size_t _mask = _size-1;
+      // The cells, with a word to spare, as the heap only aligns to eight bytes.
+      gc_array_ptr<std::uint64_t> _slots{_size * cell_words + 1};
+      // Slots claimed, tombstones included.
+      std::atomic<std::size_t> _used{0};
+      // Slots holding live keys.  Only a guide to sizing the replacement,
+      // so it can be off for a moment while a key is copied and removed.
+      std::atomic<std::size_t> _live{0};
+      std::atomic<gc_ptr<segment>> _replacement{nullptr};
+      mutable std::atomic<std::size_t> _next_to_migrate{0};
+
+      friend class gc_inline_map;
+
+      /*
+       * A double-word CAS on a misaligned cell would go through
+       * libatomic's locks, which are per process, so the cells start at
+       * the first sixteen-byte boundary in _slots.  The heap is mapped
+       * page aligned, so that's the same offset in every process.
+       */
+      atomic_cell &cell_at(std::size_t i) const {
+        std::uintptr_t base = reinterpret_cast<std::uintptr_t>(&const_cast<segment *>(this)->_slots[0]);
+        base = (base + alignof(atomic_cell) - 1) & ~std::uintptr_t(alignof(atomic_cell) - 1);
+        return reinterpret_cast<atomic_cell *>(base)[i];
+      }
+
+      probe_result probe(const key_type &key, hash_type hash) const {
+        probe_result r;
+        for (std::size_t n = 0; n < _size; n++) {
+          r.index = (hash + n) & _mask;
+          r.contents = cell_at(r.index).load();
+          if (r.contents.is_frozen()) {
+            r.frozen = true;
+            return r;
+          }
+          if (r.contents.status() == empty) {
+            return r;
+          }
+          if (r.contents.key() == key) {
+            r.found = true;
+            return r;
+          }
+        }
+        r.full = true;
+        return r;
+      }
+
+      bool claimed(std::size_t i, cell &expected, const cell &desired) {
+        if (!cell_at(i).compare_exchange_strong(expected, desired)) {
+          return false;
+        }
+        _live.fetch_add(1);
+        if (_used.fetch_add(1) + 1 > _size * 3 / 4) {
+          grow();
+        }
+        return true;
+      }
+
+      /*
+       * Used when copying into a replacement.  If the key's already
+       * there, somebody else copied it (or has changed it since, which
+       * is newer), and if the segment is frozen, it's grown again, which
+       * means that the copy we're part of has been finished by somebody
+       * else.
+       */
+      void insert_if_absent(const cell &c, hash_type hash) {
+        const key_type key = c.key();
+        while (true) {
+          probe_result r = probe(key, hash);
+          if (r.found || r.frozen || r.full) {
+            return;
+          }
+          if (cell_at(r.index).compare_exchange_strong(r.contents, c)) {
+            _used.fetch_add(1);
+            _live.fetch_add(1);
+            return;
+          }
+        }
+      }
+
+      void grow() {
+        if (_replacement.load() != nullptr) {
+          return;
+        }
+        // Twice the size unless it's mostly tombstones.
+        const bool mostly_live = _live.load() > _size * 3 / 8;
+        gc_ptr<segment> new_seg = make_gc<segment>(_num, mostly_live ? _slot_bits+1 : _slot_bits,
+                                                   _segments, _hash);
+        ruts::try_change_value(_replacement, nullptr, new_seg);
+        help_with_grow();
+      }
+
+      gc_ptr<segment> help_with_grow() const {
+        gc_ptr<segment> r = _replacement;
+        segment *nc_this = const_cast<segment *>(this);
+        for (std::size_t i = _next_to_migrate; i < _size; /* update at end */) {
+          atomic_cell &ac = cell_at(i);
+          cell c = ac.load();
+          while (!c.is_frozen() && !ac.compare_exchange_weak(c, c.with_status(c.st | frozen))) {
+            // c has been reloaded
+          }
+          if (c.status() == live) {
+            r->insert_if_absent(c.with_status(live), _hash(c.key()));
+          }
+          i = ruts::increment_to_at_least(_next_to_migrate, i+1).resulting_value();
+        }
+        ruts::cas_loop_return_value<gc_ptr<segment>>
+          install_res = ruts::try_change_value(_segments[_num], this_as_gc_ptr(nc_this), r);
+        // As with gc_cuckoo_map, the old segment is dropped on the floor.
+        return install_res.resulting_value();
+      }
+
+    public:
+      segment(gc_token &gc, std::size_t n, std::size_t slot_bits, const segments_type &segs,
+              const hash_fn_type &h)
+        : gc_allocated{gc},
+          _num(n),
+          _segments(segs),
+          _hash(h),
+          _slot_bits(slot_bits)
+      {
+        assert(reinterpret_cast<std::uintptr_t>(&cell_at(0)) % alignof(atomic_cell) == 0);
+        assert(reinterpret_cast<const char *>(&cell_at(0) + _size)
+               <= reinterpret_cast<const char *>(&_slots[0] + _slots->size()));
+      }
+
+      static const auto &descriptor() {
+        static gc_descriptor d =
+          GC_DESC(segment)
+          .template WITH_FIELD(&segment::_num)
+          .template WITH_FIELD(&segment::_segments)
+          .template WITH_FIELD(&segment::_hash)
+          .template WITH_FIELD(&segment::_slot_bits)
+          .template WITH_FIELD(&segment::_size)
+          .template WITH_FIELD(&segment::_mask)
+          .template WITH_FIELD(&segment::_slots)
+          .template WITH_FIELD(&segment::_used)
+          .template WITH_FIELD(&segment::_live)
+          .template WITH_FIELD(&segment::_replacement)
+          .template WITH_FIELD(&segment::_next_to_migrate);
+        return d;
+      }
+    };
+
+    const hash_fn_type _hash;
+    const segments_type _segments = make_gc_array<atomic_seg_ptr>(n_segments);
+
+    gc_ptr<segment> segment_for(hash_type hash) const {
+      return _segments[left_bit_field(hash, n_seg_bits)];
+    }
+
+    static std::size_t slot_bits_for(std::size_t cap) {
+      // Room for cap at three quarters full.
+      std::size_t bits = 1;
+      std::size_t size = n_segments << 1;
+      while (size * 3 / 4 < cap) {
+        bits++;
+        size <<= 1;
+      }
+      return bits;
+    }
+
+    // Calls fn(segment, probe_result) once the key's segment isn't growing.
+    template <typename Fn>
+    auto with_probe(const key_type &key, Fn &&fn) const {
+      hash_type hash = _hash(key);
+      gc_ptr<segment> seg = segment_for(hash);
+      while (true) {
+        probe_result r = seg->probe(key, hash);
+        if (r.frozen) {
+          seg = seg->help_with_grow();
+        } else if (r.full) {
+          seg->grow();
+          seg = seg->help_with_grow();
+        } else {
+          return fn(seg, r);
+        }
+      }
+    }
+
+  public:
+    struct replace_return {
+      bool replaced = false;
+      bool had_value = false;
+      value_type old_value{};
+      operator bool() const {
+        return replaced;
+      }
+      replace_return() {}
+      replace_return(bool r, bool hv, const value_type &ov)
+      : replaced(r),
+        had_value(hv),
+        old_value(ov)
+      {}
+    };
+
+    gc_inline_map(gc_token &gc, const hash_fn_type &h, std::size_t capacity = default_cap)
+      : gc_allocated{gc},
+        _hash(h)
+    {
+      std::size_t bits = slot_bits_for(capacity);
+      std::size_t n = 0;
+      for (auto &p : _segments) {
+        p = make_gc<segment>(n++, bits, _segments, _hash);
+      }
+    }
+
+    explicit gc_inline_map(gc_token &gc, std::size_t capacity = default_cap)
+      : gc_inline_map(gc, hash_fn_type{}, capacity)
+    {}
+
+    static const auto &descriptor() {
+      static gc_descriptor d =
+        GC_DESC(gc_inline_map)
+        .template WITH_FIELD(&gc_inline_map::_hash)
+        .template WITH_FIELD(&gc_inline_map::_segments);
+      return d;
+    }
+
+  private:
+    // Looks the key up starting from seg, which is where its hash led at some point.
+    static std::pair<bool, value_type> lookup_from(gc_ptr<segment> seg, const key_type &key, hash_type hash) {
+      while (true) {
+        probe_result r = seg->probe(key, hash);
+        if (r.frozen) {
+          seg = seg->help_with_grow();
+          continue;
+        }
+        if (r.found && r.contents.status() == live) {
+          return std::make_pair(true, r.contents.value());
+        }
+        return std::make_pair(false, value_type{});
+      }
+    }
+
+  public:
+    std::pair<bool, value_type> lookup(const key_type &key) const {
+      hash_type hash = _hash(key);
+      return lookup_from(segment_for(hash), key, hash);
+    }
+
+    bool contains(const key_type &key) const {
+      return lookup(key).first;
+    }
+
+    value_type get(const key_type &key) const {
+      return lookup(key).second;
+    }
+
+    std::size_t find_batch(const key_type *keys, std::size_t n, value_type *out, bool *found = nullptr) const {
+      std::size_t n_found = 0;
+      for (std::size_t start = 0; start < n; start += batch_size) {
+        const std::size_t m = std::min(batch_size, n - start);
+        hash_type hashes[batch_size];
+        gc_ptr<segment> segs[batch_size];
+        for (std::size_t i = 0; i < m; i++) {
+          hashes[i] = _hash(keys[start + i]);
+          __builtin_prefetch(&_segments[left_bit_field(hashes[i], n_seg_bits)]);
+        }
+        for (std::size_t i = 0; i < m; i++) {
+          segs[i] = segment_for(hashes[i]);
+          __builtin_prefetch(segs[i].as_bare_pointer());
+        }
+        for (std::size_t i = 0; i < m; i++) {
+          __builtin_prefetch(&segs[i]->cell_at(hashes[i] & segs[i]->_mask));
+        }
+        for (std::size_t i = 0; i < m; i++) {
+          std::pair<bool, value_type> r = lookup_from(segs[i], keys[start + i], hashes[i]);
+          out[start + i] = r.second;
+          if (found != nullptr) {
+            found[start + i] = r.first;
+          }
+          n_found += r.first;
+        }
+      }
+      return n_found;
+    }
+
+    template <typename ... Keys>
+    std::array<value_type, sizeof...(Keys)> get_many(const Keys & ... keys) const {
+      const key_type ks[] = {keys...};
+      std::array<value_type, sizeof...(Keys)> res;
+      find_batch(ks, sizeof...(Keys), res.data());
+      return res;
+    }
+
+  private:
+    replace_return put(const key_type &key, const value_type &val, bool allow_replacep) {
+      const cell desired = cell::make(key, val, live);
+      while (true) {
+        bool retry = false;
+        replace_return rr = with_probe(key, [&](const gc_ptr<segment> &seg, probe_result &r) {
+            if (!r.found) {
+              if (!seg->claimed(r.index, r.contents, desired)) {
+                retry = true;
+              }
+              return replace_return(true, false, value_type{});
+            }
+            if (r.contents.status() == dead) {
+              // Our own tombstone.
+              if (!seg->cell_at(r.index).compare_exchange_strong(r.contents, desired)) {
+                retry = true;
+              } else {
+                seg->_live.fetch_add(1);
+              }
+              return replace_return(true, false, value_type{});
+            }
+            if (!allow_replacep) {
+              return replace_return(false, true, r.contents.value());
+            }
+            if (!seg->cell_at(r.index).compare_exchange_strong(r.contents, desired)) {
+              retry = true;
+            }
+            return replace_return(true, true, r.contents.value());
+          });
+        if (!retry) {
+          return rr;
+        }
+      }
+    }
+
+  public:
+    replace_return put(const key_type &key, const value_type &val) {
+      return put(key, val, true);
+    }
+
+    replace_return put_new(const key_type &key, const value_type &val) {
+      return put(key, val, false);
+    }
+
+    replace_return replace(const key_type &key,
+                           const value_type &expected,
+                           const value_type &val) {
+      while (true) {
+        bool retry = false;
+        replace_return rr = with_probe(key, [&](const gc_ptr<segment> &seg, probe_result &r) {
+            if (!r.found || r.contents.status() != live) {
+              return replace_return(false, false, value_type{});
+            }
+            const value_type current = r.contents.value();
+            if (!(current == expected)) {
+              return replace_return(false, true, current);
+            }
+            if (!seg->cell_at(r.index).compare_exchange_strong(r.contents, cell::make(key, val, live))) {
+              retry = true;
+            }
+            return replace_return(true, true, current);
+          });
+        if (!retry) {
+          return rr;
+        }
+      }
+    }
+
+    bool remove(const key_type &key) {
+      while (true) {
+        bool retry = false;
+        bool res = with_probe(key, [&](const gc_ptr<segment> &seg, probe_result &r) {
+            if (!r.found || r.contents.status() != live) {
+              return false;
+            }
+            if (!seg->cell_at(r.index).compare_exchange_strong(r.contents, r.contents.with_status(dead))) {
+              retry = true;
+            } else {
+              seg->_live.fetch_sub(1);
+            }
+            return true;
+          });
+        if (!retry) {
+          return res;
+        }
+      }
+    }
+
+    value_type operator[](const key_type &key) const {
+      return get(key);
+    }
+
+    // The number of slots over all the segments.
+    std::size_t slot_count() const {
+      std::size_t n = 0;
+      for (const atomic_seg_ptr &p : _segments) {
+        n += p.load()->_size;
+      }
+      return n;
+    }
+  };
+
+  /*
+   * gc_inline_map when Inline is set and K and V fit, otherwise
+   * gc_cuckoo_map.
+   */
+  template <typename K, typename V, typename Hash1=ruts::hash1<K>, typename Hash2=ruts::hash2<K>,
+            std::size_t SegBits = 10, bool Inline = true>
+  using compact_gc_cuckoo_map = std::conditional_t<Inline && fits_inline_map<K,V>::value,
+                                                   gc_inline_map<K,V,Hash1,SegBits>,
+                                                   gc_cuckoo_map<K,V,Hash1,Hash2,SegBits>>;
+}
+
+#endif /* GC_INLINE_MAP_H_ */
@@ -0,0 +1,415 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#ifndef GC_SEGMENTED_VECTOR_H_
+#define GC_SEGMENTED_VECTOR_H_
+
+#include "mpgc/gc.h"
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+
+/*
+ * A gc_basic_segmented_vector<T> is a vector kept as a spine of fixed-size
+ * gc_array chunks (of 1<<ChunkBits elements) rather than one gc_array.
+ * Growing allocates another chunk and never moves the elements already
+ * there, so push_back() is O(1) without the big allocation and copy (with
+ * write barriers) that growing a gc_vector of millions of gc_ptrs costs.
+ * Only the spine is ever copied, and it's smaller by a factor of the chunk
+ * size.  Indexing is a shift and a mask, plus one more indirection.
+ *
+ * Like gc_basic_vector<T>, it's not itself allocated, but it can sit
+ * inside something that is.
+ */
+
+namespace mpgc {
+  template <typename T, typename PC, std::size_t ChunkBits = 10>
+  class gc_basic_segmented_vector {
+    using chunk_type = gc_array<T>;
+    using chunk_ptr_type = gc_array_ptr<T>;
+    using spine_type = gc_array<chunk_ptr_type>;
+    using spine_ptr_type = typename PC::template ptr_t<spine_type>;
+  public:
+    using value_type = typename chunk_type::value_type;
+    using size_type = typename chunk_type::size_type;
+    using difference_type = typename chunk_type::difference_type;
+    using reference = value_type &;
+    using const_reference = const value_type &;
+
+    constexpr static std::size_t chunk_bits = ChunkBits;
+    constexpr static size_type chunk_size = size_type{1} << chunk_bits;
+
+    template <bool IsConst>
+    class iter_ {
+    public:
+      using vector_type = std::conditional_t<IsConst, const gc_basic_segmented_vector, gc_basic_segmented_vector>;
+      using value_type = std::conditional_t<IsConst, const gc_basic_segmented_vector::value_type,
+                                            gc_basic_segmented_vector::value_type>;
+      using reference = value_type &;
+      using pointer = value_type *;
+      using difference_type = std::ptrdiff_t;
+      using iterator_category = std::random_access_iterator_tag;
+    private:
+      vector_type *_vector = nullptr;
+      difference_type _index = 0;
+      friend class gc_basic_segmented_vector;
+      template <bool> friend class iter_;
+      iter_(vector_type *v, difference_type i) : _vector{v}, _index{i} {}
+    public:
+      iter_() = default;
+      template <bool C, typename = std::enable_if_t<IsConst || !C>>
+      iter_(const iter_<C> &other) : _vector{other._vector}, _index{other._index} {}
+
+      reference operator*() const {
+        return (*_vector)[_index];
+      }
+      pointer operator->() const {
+        return &**this;
+      }
+      reference operator[](difference_type n) const {
+        return (*_vector)[_index+n];
+      }
+      iter_ &operator++() {
+        ++_index;
+        return *this;
+      }
+      iter_ operator++(int) {
+        iter_ old = *this;
+        ++_index;
+        return old;
+      }
+      iter_ &operator--() {
+        --_index;
+        return *this;
+      }
+      iter_ operator--(int) {
+        iter_ old = *this;
+        --_index;
+        return old;
+      }
+      iter_ &operator+=(difference_type n) {
+        _index += n;
+        return *this;
+      }
+      iter_ &operator-=(difference_type n) {
+        _index -= n;
+        return *this;
+      }
+      iter_ operator+(difference_type n) const {
+        return iter_{_vector, _index+n};
+      }
+      friend iter_ operator+(difference_type n, const iter_ &it) {
+        return it+n;
+      }
+      iter_ operator-(difference_type n) const {
+        return iter_{_vector, _index-n};
+      }
+      template <bool C>
+      difference_type operator-(const iter_<C> &other) const {
+        return _index-other._index;
+      }
+      template <bool C>
+      bool operator==(const iter_<C> &other) const {
+        return _index == other._index && _vector == other._vector;
+      }
+      template <bool C>
+      bool operator!=(const iter_<C> &other) const {
+        return !(*this == other);
+      }
+      template <bool C>
+      bool operator<(const iter_<C> &other) const {
+        return _index < other._index;
+      }
+      template <bool C>
+      bool operator>(const iter_<C> &other) const {
+        return _index > other._index;
+      }
+      template <bool C>
+      bool operator<=(const iter_<C> &other) const {
+        return _index <= other._index;
+      }
+      template <bool C>
+      bool operator>=(const iter_<C> &other) const {
+        return _index >= other._index;
+      }
+    };
+
+    using iterator = iter_<false>;
+    using const_iterator = iter_<true>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  private:
+    constexpr static size_type min_spine = 4;
+    constexpr static size_type chunk_mask = chunk_size-1;
+    spine_ptr_type _spine = nullptr;
+    size_type _n_chunks = 0;
+    size_type _size = 0;
+
+    void ensure_capacity(size_type count) {
+      if (count <= capacity()) {
+        return;
+      }
+      const size_type needed = (count + chunk_mask) >> chunk_bits;
+      size_type spine_cap = _spine == nullptr ? 0 : _spine->size();
+      if (needed > spine_cap) {
+        // Only chunk pointers get copied, never elements.
+        size_type c = std::max(min_spine, spine_cap);
+        while (c < needed) {
+          c *= 2;
+        }
+        spine_ptr_type new_spine = make_gc<spine_type>(c);
+        for (size_type i = 0; i < _n_chunks; i++) {
+          new_spine[i] = _spine[i];
+        }
+        _spine = new_spine;
+      }
+      while (_n_chunks < needed) {
+        _spine[_n_chunks] = make_gc<chunk_type>(chunk_size);
+        _n_chunks++;
+      }
+    }
+
+    [[noreturn]] void throw_out_of_range(size_type pos, size_type n) const {
+      std::ostringstream ss;
+      ss << "Pos: " << pos << "; len: " << n;
+      throw std::out_of_range{ss.str()};
+    }
+
+    void check_pos(size_type pos) const {
+      if (pos >= _size) {
+        throw_out_of_range(pos, _size);
+      }
+    }
+
+    void clear_range(size_type from, size_type to) {
+      for (size_type i = from; i < to; i++) {
+        (*this)[i] = value_type{};
+      }
+    }
+
+  public:
+    static const auto &descriptor() {
+      static gc_descriptor d =
+	GC_DESC(gc_basic_segmented_vector)
+	.template WITH_FIELD(&gc_basic_segmented_vector::_spine)
+	.template WITH_FIELD(&gc_basic_segmented_vector::_n_chunks)
+	.template WITH_FIELD(&gc_basic_segmented_vector::_size);
+      return d;
+    }
+
+    gc_basic_segmented_vector() = default;
+    explicit gc_basic_segmented_vector(size_type count) {
+      resize(count);
+    }
+    gc_basic_segmented_vector(size_type count, const value_type &value) {
+      resize(count, value);
+    }
+
+    gc_basic_segmented_vector(gc_basic_segmented_vector &&other)
+      : _spine{std::move(other._spine)}, _n_chunks{other._n_chunks}, _size{other._size} {
+      other._spine = nullptr;
+      other._n_chunks = 0;
+      other._size = 0;
+    }
+    gc_basic_segmented_vector &operator =(gc_basic_segmented_vector &&other) {
+      _spine = std::move(other._spine);
+      _n_chunks = other._n_chunks;
+      _size = other._size;
+      other._spine = nullptr;
+      other._n_chunks = 0;
+      other._size = 0;
+      return *this;
+    }
+
+    reference operator[](size_type pos) {
+      return _spine[pos >> chunk_bits][pos & chunk_mask];
+    }
+    const_reference operator[](size_type pos) const {
+      return _spine[pos >> chunk_bits][pos & chunk_mask];
+    }
+
+    reference at(size_type pos) {
+      check_pos(pos);
+      return (*this)[pos];
+    }
+    const_reference at(size_type pos) const {
+      check_pos(pos);
+      return (*this)[pos];
+    }
+
+    reference front() {
+      return (*this)[0];
+    }
+    const_reference front() const {
+      return (*this)[0];
+    }
+    reference back() {
+      return (*this)[_size-1];
+    }
+    const_reference back() const {
+      return (*this)[_size-1];
+    }
+
+    iterator begin() {
+      return iterator{this, 0};
+    }
+    const_iterator cbegin() const {
+      return const_iterator{this, 0};
+    }
+    const_iterator begin() const {
+      return cbegin();
+    }
+    iterator end() {
+      return begin()+_size;
+    }
+    const_iterator cend() const {
+      return cbegin()+_size;
+    }
+    const_iterator end() const {
+      return cend();
+    }
+
+    reverse_iterator rbegin() {
+      return reverse_iterator(end());
+    }
+    const_reverse_iterator crbegin() const {
+      return const_reverse_iterator(cend());
+    }
+    const_reverse_iterator rbegin() const {
+      return crbegin();
+    }
+    reverse_iterator rend() {
+      return reverse_iterator(begin());
+    }
+    const_reverse_iterator crend() const {
+      return const_reverse_iterator(cbegin());
+    }
+    const_reverse_iterator rend() const {
+      return crend();
+    }
+
+    bool empty() const noexcept {
+      return _size==0;
+    }
+
+    size_type size() const noexcept {
+      return _size;
+    }
+
+    size_type max_size() const noexcept {
+      return std::numeric_limits<size_type>::max();
+    }
+
+    size_type capacity() const noexcept {
+      return _n_chunks << chunk_bits;
+    }
+
+    void reserve(size_type new_cap) {
+      ensure_capacity(new_cap);
+    }
+
+    void clear() {
+      clear_range(0, _size);
+      _size = 0;
+    }
+
+    void push_back(const value_type &value) {
+      ensure_capacity(_size+1);
+      (*this)[_size++] = value;
+    }
+    void push_back(value_type &&value) {
+      ensure_capacity(_size+1);
+      (*this)[_size++] = std::move(value);
+    }
+    template <typename... Args>
+    iterator emplace_back(Args&&...args) {
+      ensure_capacity(_size+1);
+      reference ref = (*this)[_size];
+      ref = value_type{};
+      new (&ref) value_type(std::forward<Args>(args)...);
+      return begin()+(_size++);
+    }
+
+    void pop_back() {
+      if (_size > 0) {
+        back() = value_type{};
+        _size--;
+      }
+    }
+
+    // Elements past _size are always default, so growing needs no filling.
+    void resize(size_type count) {
+      if (count > _size) {
+        ensure_capacity(count);
+      } else {
+        clear_range(count, _size);
+      }
+      _size = count;
+    }
+
+    void resize(size_type count, const value_type &value) {
+      if (count > _size) {
+        ensure_capacity(count);
+        for (size_type i = _size; i < count; i++) {
+          (*this)[i] = value;
+        }
+      } else {
+        clear_range(count, _size);
+      }
+      _size = count;
+    }
+
+    void swap(gc_basic_segmented_vector &other) {
+      std::swap(_spine, other._spine);
+      std::swap(_n_chunks, other._n_chunks);
+      std::swap(_size, other._size);
+    }
+  };
+
+  template <typename T, std::size_t ChunkBits = 10>
+  using gc_segmented_vector = gc_basic_segmented_vector<T,internal_pointers,ChunkBits>;
+  template <typename T, std::size_t ChunkBits = 10>
+  using external_gc_segmented_vector = gc_basic_segmented_vector<T,external_pointers,ChunkBits>;
+
+  template <typename T, std::size_t ChunkBits>
+  struct is_collectible<gc_segmented_vector<T,ChunkBits>> : is_collectible<T>
+  {};
+
+}
+
+namespace std {
+  template <typename T, typename PC, std::size_t ChunkBits>
+  void swap(mpgc::gc_basic_segmented_vector<T,PC,ChunkBits> &lhs,
+            mpgc::gc_basic_segmented_vector<T,PC,ChunkBits> &rhs) {
+    lhs.swap(rhs);
+  }
+}
+
+#endif /* GC_SEGMENTED_VECTOR_H_ */
@@ -0,0 +1,165 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#ifndef GC_TELEMETRY_H_
+#define GC_TELEMETRY_H_
+
+#include <atomic>
+#include <cstdint>
+
+namespace mpgc {
+  /*
+   * A histogram with log-linear buckets, i.e. every power of two is split
+   * into 2^sub_bucket_log_bits buckets, which bounds the relative error of
+   * any value read back to 1/2^sub_bucket_log_bits. Values below that are
+   * counted exactly. It lives in the control block, so it's recorded into
+   * and read from any process.
+   */
+  class log_histogram {
+   public:
+    constexpr static unsigned sub_bucket_log_bits = 3;
+    constexpr static unsigned sub_buckets = 1u << sub_bucket_log_bits;
+    constexpr static unsigned n_buckets = (64 - sub_bucket_log_bits + 1) << sub_bucket_log_bits;
+
+   private:
+    std::atomic<std::uint64_t> _counts[n_buckets];
+    std::atomic<std::uint64_t> _total;
+    std::atomic<std::uint64_t> _sum;
+    std::atomic<std::uint64_t> _max;
+
+   public:
+    log_histogram() {
+      reset();
+    }
+
+    constexpr static unsigned bucket_for(std::uint64_t v) {
+      return v < sub_buckets ? unsigned(v)
+        : ((63 - __builtin_clzl(v) - sub_bucket_log_bits + 1) << sub_bucket_log_bits)
+          | unsigned((v >> (63 - __builtin_clzl(v) - sub_bucket_log_bits)) & (sub_buckets - 1));
+    }
+
+    //Smallest value counted in bucket b.
+    constexpr static std::uint64_t bucket_lower(unsigned b) {
+      return b < sub_buckets ? b
+        : (std::uint64_t(sub_buckets | (b & (sub_buckets - 1))) << ((b >> sub_bucket_log_bits) - 1));
+    }
+
+    void record(std::uint64_t v) {
+      _counts[bucket_for(v)].fetch_add(1, std::memory_order_relaxed);
+      _total.fetch_add(1, std::memory_order_relaxed);
+      _sum.fetch_add(v, std::memory_order_relaxed);
+      std::uint64_t m = _max.load(std::memory_order_relaxed);
+      while (v > m && !_max.compare_exchange_weak(m, v, std::memory_order_relaxed));
+    }
+
+    void reset() {
+      for (std::atomic<std::uint64_t> &c : _counts) {
+        c.store(0);
+      }
+      _total = 0;
+      _sum = 0;
+      _max = 0;
+    }
+
+    std::uint64_t count() const { return _total; }
+    std::uint64_t sum() const   { return _sum; }
+    std::uint64_t max() const   { return _max; }
+    std::uint64_t count_in(unsigned b) const { return _counts[b].load(std::memory_order_relaxed); }
+
+    //The lower bound of the bucket holding the p-th quantile, 0 <= p <= 1.
+    std::uint64_t value_at(double p) const {
+      const std::uint64_t target = std::uint64_t(p * count());
+      std::uint64_t seen = 0;
+      for (unsigned b = 0; b < n_buckets; b++) {
+        seen += count_in(b);
+        if (seen > target) {
+          return bucket_lower(b);
+        }
+      }
+      return max();
+    }
+  };
+
+  /* The phases a GC thread goes through in a cycle. The flip is the
+   * sweep handshake, when the threads switch to the other global list.
+   */
+  enum class gc_phase : uint8_t {
+    sync1,
+    sync2,
+    async,
+    marking,
+    flip,
+    sweep1,
+    sweep2,
+    count
+  };
+
+  constexpr const char *phase_name(gc_phase p) {
+    return p == gc_phase::sync1 ? "sync1"
+      : p == gc_phase::sync2 ? "sync2"
+      : p == gc_phase::async ? "async"
+      : p == gc_phase::marking ? "marking"
+      : p == gc_phase::flip ? "flip"
+      : p == gc_phase::sweep1 ? "sweep1"
+      : p == gc_phase::sweep2 ? "sweep2"
+      : "unknown";
+  }
+
+  /*
+   * Everything is recorded by every process's GC thread, so with several
+   * processes there are that many samples per cycle. The durations are in
+   * nanoseconds.
+   */
+  struct gc_telemetry {
+    log_histogram phase_ns[std::size_t(gc_phase::count)];
+    log_histogram handshake_ns;
+    log_histogram allocation_stall_ns;
+    log_histogram bytes_marked;
+    //Everything the sweep hands to the free lists, including free space it
+    //merely re-coalesced, so this is not the same as what the cycle reclaimed.
+    log_histogram bytes_swept_to_lists;
+    std::atomic<std::uint64_t> steals;
+
+    gc_telemetry() : steals(0) {}
+
+    log_histogram &phase(gc_phase p) {
+      return phase_ns[std::size_t(p)];
+    }
+
+    void reset() {
+      for (log_histogram &h : phase_ns) {
+        h.reset();
+      }
+      handshake_ns.reset();
+      allocation_stall_ns.reset();
+      bytes_marked.reset();
+      bytes_swept_to_lists.reset();
+      steals = 0;
+    }
+  };
+}
+
+#endif /* GC_TELEMETRY_H_ */
@@ -55,6 +55,7 @@
 #include "mpgc/mark_buffer.h"
 #include "mpgc/offset_ptr.h"
 #include "mpgc/gc_allocator.h"
+#include "mpgc/gc_trace.h"
 /*
  * This class contains all the per-process structures.
  */
@@ -89,13 +90,59 @@ namespace mpgc {
     preSweep,
     sweep1,
     sweep2,
-    postSweep,
     arraysize,
     marking1 //must be the last one
   };
 
+  /* A thread's allocation counts. Only the thread itself bumps them, and
+   * whoever folds them into the global stats keeps track of how much has
+   * already been taken, so the thread doesn't need an atomic increment.
+   * They live in the shared heap, next to the thread's mark buffer, so that
+   * whoever cleans up after a dead process can still take them.
+   */
+  class allocation_counts {
+    std::atomic<std::size_t> _bytes{0};
+    std::atomic<std::size_t> _objects{0};
+    std::atomic<std::size_t> _folded_bytes{0};
+    std::atomic<std::size_t> _folded_objects{0};
+    std::atomic<bool> _dead{false};
+
+    //Two processes cleaning up after a dead one can't both take the same counts.
+    static std::size_t take(const std::atomic<std::size_t> &count, std::atomic<std::size_t> &folded) {
+      const std::size_t c = count.load(std::memory_order_relaxed);
+      std::size_t f = folded.load();
+      while (f < c) {
+        if (folded.compare_exchange_weak(f, c)) {
+          return c - f;
+        }
+      }
+      return 0;
+    }
+
+  public:
+    static bool is_marked(allocation_counts *c) {
+      return c->_dead;
+    }
+
+    void mark_dead() {
+      _dead = true;
+    }
+
+    void count(std::size_t bytes, std::size_t n) {
+      _bytes.store(_bytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+      _objects.store(_objects.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    //Adds the counts since the last call to bytes and n.
+    void take(std::size_t &bytes, std::size_t &n) {
+      bytes += take(_bytes, _folded_bytes);
+      n += take(_objects, _folded_objects);
+    }
+  };
+
   using Mbuf = mark_buffer<offset_ptr<const gc_allocated>>;
   using Mark_buffer_list = ruts::sequential_lazy_delete_collection<Mbuf, ruts::managed_space::allocator<Mbuf>>;
+  using Allocation_counts_list = ruts::sequential_lazy_delete_collection<allocation_counts, ruts::managed_space::allocator<allocation_counts>>;
   using Traversal_queue = work_stealing_wq<offset_ptr<const gc_allocated>>;
   using Pre_sweep_list = std::deque<std::size_t, ruts::managed_space::allocator<std::size_t>>;
 
@@ -157,12 +204,19 @@ namespace mpgc {
     ruts::atomic16B<liveness> _liveness;
     Barrier_info _binfo;
     Mark_buffer_list _mark_buffer_list;
+    Allocation_counts_list _allocation_counts_list;
 
     Traversal_queue _tqueue;
     Pre_sweep_list  _pre_sweep_list;
 
     volatile gc_status _status;
 
+    //Bumped only by this process's GC thread, but taken by whoever cleans up after it if it dies.
+    std::atomic<std::size_t> _marked_bytes{0};
+    std::atomic<std::size_t> _marked_objects{0};
+
+    trace_ring _trace;
+
   public:
    per_process_struct () :
       _liveness(liveness(getpid())),
@@ -176,6 +230,7 @@ namespace mpgc {
       _tqueue.~Traversal_queue();
       _pre_sweep_list.~Pre_sweep_list();
       _mark_buffer_list.~Mark_buffer_list();
+      _allocation_counts_list.~Allocation_counts_list();
     }
 
     void mark_dead() {
@@ -280,6 +335,10 @@ namespace mpgc {
       return _mark_buffer_list;
     }
 
+    Allocation_counts_list &allocation_counts_list() {
+      return _allocation_counts_list;
+    }
+
     Traversal_queue &traversal_queue() {
       return _tqueue;
     }
@@ -288,8 +347,44 @@ namespace mpgc {
       return _pre_sweep_list;
     }
 
+    /* The counts of threads that exited since the last fold aren't lost, but
+     * carried over as marked counts, which the next fold picks up.
+     */
     void clear() {
       _mark_buffer_list.deletion(Mbuf::is_marked);
+      _allocation_counts_list.deletion([this](allocation_counts *c) {
+          if (!allocation_counts::is_marked(c)) {
+            return false;
+          }
+          std::size_t bytes = 0, n = 0;
+          c->take(bytes, n);
+          _marked_bytes.fetch_add(bytes);
+          _marked_objects.fetch_add(n);
+          return true;
+        });
+    }
+
+    void count_marked(std::size_t bytes) {
+      _marked_bytes.store(_marked_bytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+      _marked_objects.store(_marked_objects.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    //Adds the counts since the last call to bytes and n. The exchange means that
+    //two processes cleaning up after a dead one can't both take its counts.
+    void take_marked(std::size_t &bytes, std::size_t &n) {
+      bytes += _marked_bytes.exchange(0);
+      n += _marked_objects.exchange(0);
+    }
+
+    //Adds what this process's threads allocated since the last call to bytes and n.
+    void take_allocated(std::size_t &bytes, std::size_t &n) {
+      for (allocation_counts *c = _allocation_counts_list.head(); c; c = _allocation_counts_list.next(c)) {
+        c->take(bytes, n);
+      }
+    }
+
+    trace_ring &trace() {
+      return _trace;
     }
 
     liveness get_liveness() { return _liveness.load();}
@@ -327,8 +422,30 @@ namespace mpgc {
     const std::size_t _sweep_bitmap_size;
     Allocator _alloc;
 
-    atomic_rep_t * const _begin;
-    atomic_rep_t * const _end;
+    /* There are two copies of the mark-bitmap (along with their sweep
+     * bitmaps), used in alternate GC cycles. The copy used for marking is
+     * selected by the global list index of the cycle. While one copy is
+     * being swept, the other one (idle) is cleared chunk by chunk as part
+     * of sweep2 phase. This way we don't need a separate pass (and a
+     * barrier) at the end of every cycle to clear the mark-bitmap.
+     *
+     * Without that barrier, one process's GC thread may still be selecting
+     * the copy for the next cycle while another process's mutators are
+     * already marking in it. So only the index of the copy is shared (and
+     * atomic), and the pointers below are all derived from it.
+     */
+    atomic_rep_t * const _bitmaps;
+    std::atomic<uint8_t> _copy{0};
+
+    /* Process-local cache of the marking copy, so that marking and
+     * is_marked() don't have to go through _copy on every call. It is
+     * filled in by this process's GC thread right where it selects the copy
+     * after the sweep2 barrier, so it never disagrees with what this
+     * process selected. Until then (or for any other bitmap) we fall back
+     * to _copy.
+     */
+    static std::atomic<const mark_bitmap*> _cached_owner;
+    static std::atomic<atomic_rep_t*> _cached_begin;
 
     /* Sweep bitmap is a bitmap over the mark-bitmap. It is required
      * in order to have a lock-free sweep function. There is a bit
@@ -339,20 +456,39 @@ namespace mpgc {
      *
      * The meaning of 0s and 1s is toggled after every GC cycle.
      */
-    atomic_rep_t * const _sweep_bitmap_begin;
-    atomic_rep_t * const _sweep_bitmap_end;
 
     std::atomic<std::size_t> _logical_chunks;
-    std::atomic<std::size_t> _sweep_bitmap_words;
 
     void fetch_logical_chunk_to_process(std::size_t &i) {
       i = _logical_chunks;
       while (!_logical_chunks.compare_exchange_weak(i, i + 1));
     }
 
-    void fetch_sweep_bitmap_word_to_process(std::size_t &i) {
-      i = _sweep_bitmap_words;
-      while(!_sweep_bitmap_words.compare_exchange_weak(i, i + 1));
+    //Size of one copy of mark-bitmap, including its sweep bitmap.
+    std::size_t bitmap_copy_size() const {
+      return (_size + _sweep_bitmap_size) * 2;
+    }
+
+    atomic_rep_t *copy_at(const uint8_t idx) const {
+      return _bitmaps + idx * bitmap_copy_size();
+    }
+    atomic_rep_t *begin_bitmap() const {
+      if (_cached_owner.load(std::memory_order_relaxed) == this) {
+        return _cached_begin.load(std::memory_order_relaxed);
+      }
+      return copy_at(_copy.load(std::memory_order_acquire));
+    }
+    atomic_rep_t *end_bitmap() const {
+      return begin_bitmap() + _size;
+    }
+    atomic_rep_t *sweep_bitmap_begin() const {
+      return end_bitmap() + _size;
+    }
+    atomic_rep_t *sweep_bitmap_end() const {
+      return sweep_bitmap_begin() + _sweep_bitmap_size;
+    }
+    atomic_rep_t *idle_bitmap() const {
+      return copy_at(1 - _copy.load(std::memory_order_acquire));
     }
 
     static constexpr rep_t construct_left_mask(const bit_number_t bit) {
@@ -380,13 +516,13 @@ namespace mpgc {
     }
 
     void set_sweep_bitmap_begin(const std::size_t nr_chunk, const bool set) {
-      set_sweep_bitmap(_sweep_bitmap_begin[nr_chunk >> value_log_bits],
+      set_sweep_bitmap(sweep_bitmap_begin()[nr_chunk >> value_log_bits],
                        construct_bitmap_word(nr_chunk & (bits_per_value - 1)),
                        set);
     }
 
     void set_sweep_bitmap_end(const std::size_t nr_chunk, const bool set) {
-      set_sweep_bitmap(_sweep_bitmap_end[nr_chunk >> value_log_bits],
+      set_sweep_bitmap(sweep_bitmap_end()[nr_chunk >> value_log_bits],
                        construct_bitmap_word(nr_chunk & (bits_per_value - 1)),
                        set);
     }
@@ -394,17 +530,17 @@ namespace mpgc {
     void set_sweep_bitmap_both(const std::size_t nr_chunk, const bool set) {
       const std::size_t index = nr_chunk >> value_log_bits;
       const std::size_t desired = construct_bitmap_word(nr_chunk & (bits_per_value - 1));
-      set_sweep_bitmap(_sweep_bitmap_end[index], desired, set);
-      set_sweep_bitmap(_sweep_bitmap_begin[index], desired, set);
+      set_sweep_bitmap(sweep_bitmap_end()[index], desired, set);
+      set_sweep_bitmap(sweep_bitmap_begin()[index], desired, set);
     }
 
     bool is_end_sweep_bitmap_set(const std::size_t nr_chunk, const bool set) {
-      const rep_t val = _sweep_bitmap_end[nr_chunk >> value_log_bits];
+      const rep_t val = sweep_bitmap_end()[nr_chunk >> value_log_bits];
       const rep_t expected = construct_bitmap_word(nr_chunk & (bits_per_value - 1));
       return set ? val & expected : ~val & expected;
     }
 
-    void _post_sweep_clear(atomic_rep_t &, atomic_rep_t *, const bool);
+    void _clear_idle_chunk(atomic_rep_t &, atomic_rep_t *, const rep_t, const bool);
     void _set_sweep_bitmap_range(const std::size_t, const std::size_t, const bool);
 
     static std::size_t compute_bitmap_size(std::size_t heap_size) {
@@ -417,12 +553,12 @@ namespace mpgc {
 
     atomic_rep_t &lookup_begin(const bitmap_idx_t idx) {
       assert(idx < _size);
-      return _begin[idx];
+      return begin_bitmap()[idx];
     }
 
     atomic_rep_t &lookup_end(const bitmap_idx_t idx) {
       assert(idx < _size);
-      return _end[idx];
+      return end_bitmap()[idx];
     }
 
     bool mark_begin(const bitmap_idx_t idx, const bit_number_t bit) {
@@ -477,11 +613,11 @@ namespace mpgc {
     }
 
     void clear_chunk_begin(const std::size_t nr_chunk) {
-      std::memset(_begin + (nr_chunk << chunk_size_log_bits), 0x0, sizeof(atomic_rep_t) << chunk_size_log_bits);
+      std::memset(begin_bitmap() + (nr_chunk << chunk_size_log_bits), 0x0, sizeof(atomic_rep_t) << chunk_size_log_bits);
     }
 
     void clear_chunk_end(const std::size_t nr_chunk) {
-      std::memset(_end + (nr_chunk << chunk_size_log_bits), 0x0, sizeof(atomic_rep_t) << chunk_size_log_bits);
+      std::memset(end_bitmap() + (nr_chunk << chunk_size_log_bits), 0x0, sizeof(atomic_rep_t) << chunk_size_log_bits);
     }
 
   public:
@@ -489,7 +625,8 @@ namespace mpgc {
     static std::size_t compute_total_bitmap_size(const std::size_t heap_size) {
       std::size_t bitmap_size = compute_bitmap_size(heap_size);
       bitmap_size += compute_sweep_bitmap_size(compute_logical_chunk_count(bitmap_size));
-      return bitmap_size * sizeof(atomic_rep_t) * 2;
+      //Two copies, each containing begin and end bitmaps.
+      return bitmap_size * sizeof(atomic_rep_t) * 4;
     }
 
     mark_bitmap(std::size_t heap_size, const Allocator &alloc = Allocator()) :
@@ -497,27 +634,65 @@ namespace mpgc {
                                          _total_logical_chunks(compute_logical_chunk_count(_size)),
                                          _sweep_bitmap_size(compute_sweep_bitmap_size(_total_logical_chunks)),
                                          _alloc(alloc),
-                                         _begin(_alloc.allocate((_size + _sweep_bitmap_size) * 2)),
-                                         _end(_begin + _size),
-                                         _sweep_bitmap_begin(_end + _size),
-                                         _sweep_bitmap_end(_sweep_bitmap_begin + _sweep_bitmap_size),
-                                         _logical_chunks(0),
-                                         _sweep_bitmap_words(0)
+                                         _bitmaps(_alloc.allocate(bitmap_copy_size() * 2)),
+                                         _logical_chunks(0)
   {
       /* TODO: This is too much of work. We have to come up with a way where we don't need to
        * clear all the bitmaps because we can come up with a solution where the bitmaps are
        * allocated on a new files which are already zero-initialized.
        */
-      std::memset(_begin, 0x0, 2 * sizeof(atomic_rep_t) * (_size + _sweep_bitmap_size));
+      std::memset(_bitmaps, 0x0, 2 * sizeof(atomic_rep_t) * bitmap_copy_size());
+      select_marking_bitmap(0);
   }
 
     ~mark_bitmap() {
-      _alloc.deallocate(_begin, 1);
+      _alloc.deallocate(_bitmaps, 1);
+    }
+
+    /* Must be called only when no one is using the mark-bitmap, i.e. after
+     * sweep2 phase and before the sync1 handshake of the next cycle. All GC
+     * threads call it with the same index, so it doesn't matter who wins.
+     * The GC thread passes cache_locally so that this process's mutators
+     * use the cached pointer from then on. The handshakes of the next cycle
+     * publish it to them.
+     */
+    void select_marking_bitmap(const uint8_t idx, const bool cache_locally = false) {
+      _copy.store(idx, std::memory_order_release);
+      if (cache_locally) {
+        _cached_begin.store(copy_at(idx), std::memory_order_relaxed);
+        _cached_owner.store(this, std::memory_order_relaxed);
+      } else if (_cached_owner.load(std::memory_order_relaxed) == this) {
+        _cached_owner.store(nullptr, std::memory_order_relaxed);
+      }
+    }
+
+    std::size_t logical_chunk_count() const {
+      return _total_logical_chunks;
+    }
+
+    //Checks that the idle copy is completely cleared after sweep2 phase.
+    bool idle_copy_is_clear(const bool set_bit) const {
+      const atomic_rep_t *idle = idle_bitmap();
+      const atomic_rep_t *idle_end = idle + _size;
+      const atomic_rep_t *idle_sweep_begin = idle_end + _size;
+      const atomic_rep_t *idle_sweep_end = idle_sweep_begin + _sweep_bitmap_size;
+      const rep_t expected = set_bit ? rep_t(-1) : 0;
+      for (std::size_t i = 0; i < _sweep_bitmap_size; i++) {
+        if (idle_sweep_begin[i] != expected || idle_sweep_end[i] != expected) {
+          return false;
+        }
+      }
+      for (std::size_t i = 0; i < _size; i++) {
+        if (idle[i] != 0 || idle_end[i] != 0) {
+          return false;
+        }
+      }
+      return true;
     }
 
     void clear() {
-      std::memset(_begin, 0x0, _size * sizeof(atomic_rep_t));
-      std::memset(_end, 0x0, _size * sizeof(atomic_rep_t));
+      std::memset(begin_bitmap(), 0x0, _size * sizeof(atomic_rep_t));
+      std::memset(end_bitmap(), 0x0, _size * sizeof(atomic_rep_t));
     }
 
     void print() {
@@ -525,7 +700,7 @@ namespace mpgc {
       std::cout << std::setfill('0') << std::hex;
       for (bitmap_idx_t i = 0; i < _size;) {
         std::cout << "[" << std::setw(3) << i << "]";
-        std::cout << std::setw(16) << _begin[i] << ":" << std::setw(16) << _end[i];
+        std::cout << std::setw(16) << begin_bitmap()[i] << ":" << std::setw(16) << end_bitmap()[i];
         std::cout << "\t";
         i++;
         if (i % 4 == 0) {
@@ -553,18 +728,45 @@ namespace mpgc {
       return _mark_begin_first(beg_byte, end_byte);
     }
 
+    /* Marks n consecutive objects of the same size, all the begin bits
+     * first. The bits falling in the same bitmap word are set together.
+     */
+    void mark_begin_first(const offset_ptr<const gc_allocated> &p, const std::size_t object_size, const std::size_t n) {
+      const std::size_t beg_byte = p.offset();
+      _mark_strided(begin_bitmap(), beg_byte, object_size, n);
+      _mark_strided(end_bitmap(), beg_byte + object_size - sizeof(std::size_t), object_size, n);
+    }
+
+    void _mark_strided(atomic_rep_t *bitmap, std::size_t byte, const std::size_t stride, std::size_t n) {
+      bitmap_idx_t idx = compute_bitmap_index(byte);
+      rep_t bits = 0;
+      for (; n > 0; n--, byte += stride) {
+        const bitmap_idx_t i = compute_bitmap_index(byte);
+        if (i != idx) {
+          bitmap[idx].fetch_or(bits);
+          idx = i;
+          bits = 0;
+        }
+        bits |= construct_bitmap_word(compute_bit_number(byte));
+      }
+      if (bits) {
+        bitmap[idx].fetch_or(bits);
+      }
+    }
+
     std::size_t find_next_free_word(std::size_t word, std::size_t end, bool &found_set_bit) const {
       bit_number_t bit = compute_bit_number(word << 3);
       bitmap_idx_t idx = compute_bitmap_index(word << 3);
       bitmap_idx_t end_idx = compute_bitmap_index(end << 3);
+      const atomic_rep_t *begin = begin_bitmap(), *end_bits = begin + _size;
       do {
-        rep_t B = _end[idx] & construct_left_mask(bit);
+        rep_t B = end_bits[idx] & construct_left_mask(bit);
         while (B == 0) {
           idx++;
           if (idx == end_idx) {
             return idx << value_log_bits;
           }
-          B = _end[idx];
+          B = end_bits[idx];
         }
         found_set_bit = true;
         if (B == 1) {
@@ -576,7 +778,7 @@ namespace mpgc {
         } else {
           bit = __builtin_clzl(B) + 1;
         }
-      } while (_begin[idx] & construct_bitmap_word(bit));
+      } while (begin[idx] & construct_bitmap_word(bit));
       return (idx << value_log_bits) + bit;
     }
 
@@ -587,13 +789,14 @@ namespace mpgc {
       if (idx >= end_idx) {
         return idx << value_log_bits;
       }
-      rep_t B = _begin[idx] & construct_left_mask(bit);
+      const atomic_rep_t *begin = begin_bitmap();
+      rep_t B = begin[idx] & construct_left_mask(bit);
       while (B == 0) {
         idx++;
         if (idx == end_idx) {
           return idx << value_log_bits;
         }
-        B = _begin[idx];
+        B = begin[idx];
       }
       return (idx << value_log_bits) + __builtin_clzl(B);
     }
@@ -602,20 +805,20 @@ namespace mpgc {
     std::size_t find_prev_used_word(std::size_t word) const {
       bit_number_t bit = compute_bit_number(word << 3);
       bitmap_idx_t idx = compute_bitmap_index(word << 3);
-      rep_t B = _end[idx];
+      const atomic_rep_t *end = end_bitmap();
+      rep_t B = end[idx];
       B &= construct_right_mask(bit);
       while (B == 0) {
         if (idx == 0) {
           return 0;
         }
-        B = _end[--idx];
+        B = end[--idx];
       }
       return (idx << value_log_bits) + (bits_per_value - __builtin_ctzl(B));
     }
 
     void reset_logical_chunk_count() {
       _logical_chunks = 0;
-      _sweep_bitmap_words = 0;
     }
 
     //nr_chunk: chunk number from where to start.
@@ -642,18 +845,6 @@ namespace mpgc {
       return start;
     }
 
-    void test_bitmaps(const bool set_bitmap) {
-      std::size_t i;
-      for(i = 0; i < _sweep_bitmap_size; i++) {
-        set_bitmap ? assert(_sweep_bitmap_begin[i] == rep_t(-1) && _sweep_bitmap_end[i] == rep_t(-1)) :
-                     assert(_sweep_bitmap_begin[i] == 0 && _sweep_bitmap_end[i] == 0);
-      }
-
-      for(i = 0; i < _size; i++) {
-        assert(_begin[i] == 0 && _end[i] == 0);
-      }
-    }
-
     bool expand_free_chunk(offset_ptr<gc_allocator::global_chunk> c,
                            std::size_t size,
                            std::size_t &beg_word,
@@ -667,10 +858,14 @@ namespace mpgc {
       return _mark_begin_first(beg_word << 3, (end_word - 1) << 3);
     }
 
-    void post_sweep_phase(per_process_struct*, const bool);
-    bool post_sweep_phase_without_load_balancing(per_process_struct*, const bool);
-    void post_sweep_clear(const std::size_t, const bool);
-    void process_logical_chunk(gc_allocator::globalListType&, const std::size_t, const bool);
+    //Makes the sweep skip a chunk held by a thread's local allocator.
+    void mark_local_chunk(const offset_ptr<gc_allocator::local_chunk> &p, const std::size_t size) {
+      const std::size_t beg_byte = p.offset();
+      _mark_begin_first(beg_byte, beg_byte + size - sizeof(std::size_t));
+    }
+
+    void clear_idle_chunk(const std::size_t, const bool);
+    void process_logical_chunk(gc_allocator::chunk_batch&, const std::size_t, const bool);
     void set_sweep_bitmap_range(const std::size_t, const std::size_t, const bool);
     void sweep2_phase(const bool);
   };
@@ -0,0 +1,148 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#ifndef GC_TRACE_H_
+#define GC_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace mpgc {
+  enum class trace_event : uint8_t {
+    none = 0,
+    phase_enter,    //sub: gc_phase
+    phase_exit,     //sub: gc_phase
+    barrier_inc,    //sub: barrier index, arg: value before incrementing
+    steal,          //arg: pid of the process stolen from
+    dead_process,   //arg: pid of the dead process
+    handshake_send, //sub: signal, arg: number of threads signalled
+    handshake_ack   //sub: signal
+  };
+
+  constexpr const char *trace_event_name(trace_event e) {
+    return e == trace_event::phase_enter ? "phase_enter"
+      : e == trace_event::phase_exit ? "phase_exit"
+      : e == trace_event::barrier_inc ? "barrier_inc"
+      : e == trace_event::steal ? "steal"
+      : e == trace_event::dead_process ? "dead_process"
+      : e == trace_event::handshake_send ? "handshake_send"
+      : e == trace_event::handshake_ack ? "handshake_ack"
+      : "none";
+  }
+
+  //Set once at start-up from MPGC_NO_TRACE_EVENTS.
+  extern const bool trace_events_enabled;
+
+  struct trace_record {
+    std::uint64_t ts_ns;
+    std::uint32_t tid;
+    trace_event type;
+    uint8_t sub;
+    std::uint32_t arg;
+  };
+
+  /*
+   * A fixed-size ring of the most recent GC events of one process. It lives
+   * in the process's per_process_struct, so it can be read by any process,
+   * even after the one writing it has died. Writers never wait: a slot is
+   * claimed with a fetch_add, and is overwritten once the ring wraps around.
+   * Recording is async-signal-safe, as it is done in the handshake handlers.
+   * Readers only see records whose seq was the same before and after they
+   * were copied out.
+   */
+  class trace_ring {
+   public:
+    constexpr static std::size_t capacity = 2048;
+
+   private:
+    struct alignas(32) slot {
+      //0 while the record is being written, otherwise one more than the
+      //record's position in the ring's history.
+      std::atomic<std::uint64_t> seq;
+      trace_record rec;
+    };
+    static_assert(sizeof(slot) == 32, "A trace slot is expected to be 32 bytes");
+
+    std::atomic<std::uint64_t> _head;
+    slot _slots[capacity];
+
+   public:
+    trace_ring() : _head(0) {
+      for (slot &s : _slots) {
+        s.seq.store(0, std::memory_order_relaxed);
+      }
+    }
+
+    static std::uint64_t now_ns() {
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return std::uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    void record(trace_event type, uint8_t sub = 0, std::uint32_t arg = 0) {
+      if (!trace_events_enabled) {
+        return;
+      }
+      const std::uint64_t n = _head.fetch_add(1, std::memory_order_relaxed);
+      slot &s = _slots[n % capacity];
+      s.seq.store(0, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      s.rec.ts_ns = now_ns();
+      s.rec.tid = std::uint32_t(syscall(SYS_gettid));
+      s.rec.type = type;
+      s.rec.sub = sub;
+      s.rec.arg = arg;
+      s.seq.store(n + 1, std::memory_order_release);
+    }
+
+    std::uint64_t head() const {
+      return _head.load(std::memory_order_acquire);
+    }
+
+    //Calls fn(const trace_record&) with a copy of every consistent record
+    //still in the ring, oldest first.
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+      const std::uint64_t h = head();
+      for (std::uint64_t n = h > capacity ? h - capacity : 0; n < h; n++) {
+        const slot &s = _slots[n % capacity];
+        if (s.seq.load(std::memory_order_acquire) != n + 1) {
+          continue;
+        }
+        const trace_record copy = s.rec;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.seq.load(std::memory_order_relaxed) == n + 1) {
+          fn(copy);
+        }
+      }
+    }
+  };
+}
+
+#endif /* GC_TRACE_H_ */
@@ -40,6 +40,7 @@
 #include <mutex>
 #include <algorithm>
 #include <cstdint>
+#include <type_traits>
 #include "ruts/meta.h"
 //#include "mapping_table.h"
 
@@ -72,6 +73,33 @@ namespace ruts {
     }
   };
 
+  /*
+   * Integers, so that integer-keyed maps work.  These are the splitmix64
+   * finalizer with two different offsets, so the two hashes of a key
+   * are unrelated and all the bits are mixed.
+   */
+  inline std::uint64_t mix64(std::uint64_t z) noexcept {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  template <typename T>
+  class hash1<T, std::enable_if_t<std::is_integral<T>::value>> {
+  public:
+    std::uint64_t operator()(T val) const noexcept {
+      return mix64(std::uint64_t(val) + 0x9E3779B97F4A7C15ULL);
+    }
+  };
+
+  template <typename T>
+  class hash2<T, std::enable_if_t<std::is_integral<T>::value>> {
+  public:
+    std::uint64_t operator()(T val) const noexcept {
+      return mix64(std::uint64_t(val) + 0x3C6EF372FE94F82AULL);
+    }
+  };
+
   template <typename T>
   struct delegate_hash {
     std::size_t operator()(const T &val) const noexcept {
@@ -32,6 +32,8 @@
  */
 
 #include <mutex>
+#include <utility>
+#include <vector>
 #include <cassert>
 #include <cstdlib>
 
@@ -89,6 +91,26 @@ namespace mpgc {
 
   static gc_control_block *cblock = nullptr;
 
+  /*
+   * Descriptors may be built before the heap is mapped, so their names
+   * are kept here until it is.
+   */
+  static std::mutex descriptor_names_mutex;
+
+  static std::vector<std::pair<std::uint64_t, const char*>> &pending_descriptor_names() {
+    static std::vector<std::pair<std::uint64_t, const char*>> names;
+    return names;
+  }
+
+  void note_descriptor_type(std::uint64_t key, const char *type_name) {
+    std::lock_guard<std::mutex> lk(descriptor_names_mutex);
+    if (cblock == nullptr) {
+      pending_descriptor_names().emplace_back(key, type_name);
+    } else {
+      cblock->census.note_name(key, type_name);
+    }
+  }
+
   void initialize() {
     static std::once_flag done;
     std::call_once(done, [] {
@@ -99,14 +121,25 @@ namespace mpgc {
       assert(ret == 0);
 
       uint8_t* p = static_cast<uint8_t*>(mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
-      close(fd);
       if (p == MAP_FAILED)
         std::abort();
 
       base_offset_ptr::initialize(p, st.st_size);
       gc_control_block &block = ruts::managed_space::find_or_construct<gc_control_block>(42, p, st.st_size);
-      gc_allocator::initialize(st.st_size, block.global_free_list);
-      cblock = &block;
+      //The allocator keeps fd, to find the holes in the heap file.
+      gc_allocator::initialize(st.st_size, block.global_free_list, &block.large_objects, fd);
+      {
+        std::lock_guard<std::mutex> lk(descriptor_names_mutex);
+        cblock = &block;
+        for (const auto &n : pending_descriptor_names()) {
+          block.census.note_name(n.first, n.second);
+        }
+        pending_descriptor_names().clear();
+      }
+      const std::string every = ruts::env_string("MPGC_CENSUS_EVERY");
+      if (!every.empty()) {
+        block.census.set_census_every(std::strtoul(every.c_str(), nullptr, 0));
+      }
       gc_handshake::initialize1();
     });
     gc_handshake::initialize2();
@@ -31,80 +31,215 @@
  *      Author: gidra
  */
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
 #include <cassert>
 #include <mutex>
 #include <iostream>
 #include <atomic>
+#include <chrono>
+#include <thread>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
+#include "mpgc/gc.h"
 #include "mpgc/gc_allocator.h"
 #include "mpgc/gc_handshake.h"
+#include "ruts/util.h"
 
 namespace mpgc {
   extern void global_allocation_epilogue();
+  extern void record_allocation_stall(std::uint64_t);
 
   uint8_t gc_allocator::_global_list_size = 0;
   gc_allocator::globalListType *gc_allocator::global_free_lists = nullptr;
+  gc_allocator::large_object_table *gc_allocator::_large_objects = nullptr;
+  int gc_allocator::_heap_fd = -1;
 
-    void gc_allocator::_put_to_global(globalListType &list, const std::size_t idx, offset_ptr<global_chunk> c) {
-      assert(c);
+    bool gc_allocator::large_object_table::insert(const uint8_t *p, const uint8_t idx, const std::size_t cycle) {
+      assert(((p - base_offset_ptr::base()) & (page_size - 1)) == 0);
+      const std::size_t v = (p - base_offset_ptr::base()) | stamp_for(cycle) | used_bit | idx;
+      const std::size_t start = _hint.load();
+      for (std::size_t n = 0; n < large_object_table_size; n++) {
+        const std::size_t i = (start + n) % large_object_table_size;
+        std::size_t expected = 0;
+        if (_entries[i].load() == 0 && _entries[i].compare_exchange_strong(expected, v)) {
+          _hint.store(i + 1);
+          return true;
+        }
+      }
+      return false;
+    }
+
+    //Pushes the list of chunks from head to tail in front of the global list.
+    void gc_allocator::_splice_to_global(shardListType &list, const std::size_t idx,
+                                         offset_ptr<global_chunk> head, offset_ptr<global_chunk> tail) {
+      assert(head && tail);
       list_head temp = list[idx];
-      list_head desired(c);
+      list_head desired(head);
       do {
         desired._version = temp._version + 1;
-        c->set_next(temp._ptr);
+        tail->set_next(temp._ptr);
       } while(!list[idx].compare_exchange_weak(temp, desired));
     }
 
-    offset_ptr<gc_allocator::global_chunk> gc_allocator::get_chunk_from_global(globalListType &list, const std::size_t idx) {
+    void gc_allocator::chunk_batch::flush(globalListType &list) {
+      for (std::size_t i = 0; i < _global_list_size; i++) {
+        run &r = _runs[i];
+        if (r.head) {
+          _splice_to_global(list[_shard], i, r.head, r.tail);
+          _shard = (_shard + 1) % global_list_shards;
+          r = run();
+        }
+      }
+    }
+
+    //Consecutive CPUs share a shard, as they are more likely to be on the same socket.
+    uint8_t gc_allocator::home_shard() {
+      static const unsigned int n_cpus = std::max(1u, std::thread::hardware_concurrency());
+      const int cpu = sched_getcpu();
+      return cpu < 0 ? 0 : (static_cast<unsigned int>(cpu) * global_list_shards / n_cpus) % global_list_shards;
+    }
+
+    offset_ptr<gc_allocator::global_chunk> gc_allocator::get_chunk_from_global(shardListType &list, const std::size_t idx) {
       list_head cur = list[idx];
       while (cur._ptr && !list[idx].compare_exchange_weak(cur, list_head(cur._ptr->next(), cur._version + 1)));//end of loop
       return cur._ptr;
     }
 
-    offset_ptr<gc_allocator::global_chunk> gc_allocator::_get_from_global(globalListType &list,
+    /* Only the chunks in the first list can be smaller than the requested size.
+     * For big requests we pop up to best_fit_probe_count chunks, keep the
+     * smallest one that fits, and put the rest back with a single splice.
+     *
+     * This is a bounded-probe approximation of best fit, not the real thing.
+     * The free lists are lock-free stacks with no order by size, and keeping
+     * an ordered structure in the shared heap would put a lock (or something
+     * much more involved) on every allocation and sweep. The cost is that a
+     * better fitting chunk beyond the first few probes is missed, and then
+     * a bigger chunk is split (or the next list is used) instead. Chunks
+     * that are split still go back to the right list, so this shows up as
+     * somewhat more fragmentation of the chunks over 1MB, not as leaks.
+     */
+    offset_ptr<gc_allocator::global_chunk> gc_allocator::_get_fitting_chunk(shardListType &list,
                                         const std::size_t size,
                                         const std::size_t idx) {
+      const uint8_t probes = size >= best_fit_min_size ? best_fit_probe_count : 1;
+      offset_ptr<global_chunk> head = nullptr, tail = nullptr, best = nullptr;
+      auto set_aside = [&head, &tail](offset_ptr<global_chunk> c) {
+        if (tail) {
+          tail->set_next(c);
+        } else {
+          head = c;
+        }
+        tail = c;
+      };
+      for (uint8_t n = 0; n < probes; n++) {
+        offset_ptr<global_chunk> c = get_chunk_from_global(list, idx);
+        if (c == nullptr) {
+          break;
+        }
+        if (c->size() < size) {
+          set_aside(c);
+        } else if (best == nullptr || c->size() < best->size()) {
+          if (best) {
+            set_aside(best);
+          }
+          best = c;
+          if (c->size() == size) {
+            break;
+          }
+        } else {
+          set_aside(c);
+        }
+      }
+      if (head) {
+        _splice_to_global(list, idx, head, tail);
+      }
+      return best;
+    }
+
+    offset_ptr<gc_allocator::global_chunk> gc_allocator::_get_from_global(shardListType &list,
+                                        const std::size_t size,
+                                        const std::size_t idx,
+                                        const std::size_t slab_size) {
       for (std::size_t i = idx; i < _global_list_size; i++) {
-        offset_ptr<global_chunk> c = get_chunk_from_global(list, i);
+        offset_ptr<global_chunk> c = i == idx ? _get_fitting_chunk(list, size, i) : get_chunk_from_global(list, i);
 
         if (c) {//It's possible that somebody else fetched the last chunk before us.
-          if (c->size() < size) { //The condition can be true only the first time.
-            //Not large enough. Put it back!
-            _put_to_global(list, i, c);
-          } else {
-            //Found a big enough chunk. If the requested size is smaller than a slab_size,
-            //then we chop that much and put back the rest.
-            std::size_t size_to_chop = 0;
-            if (size > slab_size) {
-              size_to_chop = size;
-            } else if (c->size() > slab_size) {
-              size_to_chop = slab_size;
-            }
+          //Found a big enough chunk. If the requested size is smaller than a slab_size,
+          //then we chop that much and put back the rest.
+          std::size_t size_to_chop = 0;
+          if (size > slab_size) {
+            size_to_chop = size;
+          } else if (c->size() > slab_size) {
+            size_to_chop = slab_size;
+          }
 
-            const std::size_t new_chunk_size = c->size() - size_to_chop;
-            if (size_to_chop > 0 && new_chunk_size >= min_global_chunk_size()) {
-              /*
-               * It is important to set the size of the leftover chunk first and then of
-               * the chunk that will be used by the local allocator for fault-tolerance.
-               * Only after setting these two values should the put_to_global be called.
-               * This is necessary because otherwise, process failure in the middle of
-               * these operations can lead to a deadlock during sweeping while cleaning
-               * the garbage gc_descriptors.
-               */
-              global_chunk* put_back = new (reinterpret_cast<uint8_t*>(c.as_bare_pointer()) + size_to_chop) global_chunk(new_chunk_size);
-              c->set_size(size_to_chop);
-              put_to_global(list, new_chunk_size, put_back);
-            }
-            return c;
+          const std::size_t new_chunk_size = c->size() - size_to_chop;
+          if (size_to_chop > 0 && new_chunk_size >= min_global_chunk_size()) {
+            /*
+             * It is important to set the size of the leftover chunk first and then of
+             * the chunk that will be used by the local allocator for fault-tolerance.
+             * Only after setting these two values should the put_to_global be called.
+             * This is necessary because otherwise, process failure in the middle of
+             * these operations can lead to a deadlock during sweeping while cleaning
+             * the garbage gc_descriptors.
+             */
+            global_chunk* put_back = new (reinterpret_cast<uint8_t*>(c.as_bare_pointer()) + size_to_chop) global_chunk(new_chunk_size);
+            c->set_size(size_to_chop);
+            put_to_global(list, new_chunk_size, put_back);
           }
+          return c;
         }
       }
       return nullptr;
     }
 
+    gc_allocator::free_list_stats gc_allocator::current_free_list_stats() {
+      free_list_stats stats;
+      globalListType &list = global_free_lists[gc_handshake::thread_struct_handles.handle->status_idx.load().index()];
+      const std::size_t max_chunks = base_offset_ptr::heap_size() / min_global_chunk_size();
+      for (shardListType &shard : list) {
+        for (std::size_t i = 0; i < _global_list_size; i++) {
+          offset_ptr<global_chunk> c = shard[i].load()._ptr;
+          //The chunks may be taken off the list while we walk, so be paranoid.
+          for (std::size_t n = 0; c && c.is_valid() && n < max_chunks; n++) {
+            const std::size_t size = c->size();
+            if (size < min_global_chunk_size() || size > base_offset_ptr::heap_size()) {
+              break;
+            }
+            stats.n_chunks++;
+            stats.bytes += size;
+            stats.largest = std::max(stats.largest, size);
+            c = c->next();
+          }
+        }
+      }
+      return stats;
+    }
+
+    std::size_t gc_allocator::max_slab_size() {
+      static const std::size_t max_size = [] {
+        const std::string s = ruts::env_string("MPGC_MAX_SLAB_SIZE");
+        const std::size_t v = s.empty() ? default_max_slab_size : std::strtoul(s.c_str(), nullptr, 0);
+        return v > min_slab_size ? v : min_slab_size;
+      }();
+      return max_size;
+    }
+
+    gc_allocator::thread_alloc_state gc_allocator::current_thread_alloc_state() {
+      return gc_handshake::thread_struct_handles.handle->alloc_state;
+    }
+
     offset_ptr<gc_allocator::global_chunk> gc_allocator::get_from_global(const std::size_t size) {
       const std::size_t idx = global_list_index_for(size);
+      thread_alloc_state &state = gc_handshake::thread_struct_handles.handle->alloc_state;
+      //Set once we have been through all the shards and found nothing.
+      bool stalled = false;
+      std::chrono::steady_clock::time_point stall_start;
       do {
         global_allocation_epilogue();
         /* This while loop will ensure that we don't end-up in a situation where some other
@@ -113,18 +248,130 @@ namespace mpgc {
          * However, once we have a working GC, the thread doesn't have to fail, it can go
          * and start helping the GC until it can reclaim the required free space.
          */
-        offset_ptr<global_chunk> c = _get_from_global(global_free_lists[gc_handshake::thread_struct_handles.handle->status_idx.load().index()], size, idx);
-        if (c) {
-          return c;
+        globalListType &list = global_free_lists[gc_handshake::thread_struct_handles.handle->status_idx.load().index()];
+        //Start with our own shard and steal from the others if it has nothing big enough.
+        const uint8_t home = home_shard();
+        for (uint8_t n = 0; n < global_list_shards; n++) {
+          offset_ptr<global_chunk> c = _get_from_global(list[(home + n) % global_list_shards], size, idx, state.slab_size);
+          if (c) {
+            state.global_trips++;
+            state.global_bytes += c->size();
+            if (size <= state.slab_size) {
+              state.grow();
+            }
+            if (stalled) {
+              record_allocation_stall(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                        std::chrono::steady_clock::now() - stall_start).count());
+            }
+            return c;
+          }
+        }
+        if (!stalled) {
+          stalled = true;
+          stall_start = std::chrono::steady_clock::now();
         }
       } while (true);
       return nullptr;
     }
 
+    void gc_allocator::put_to_local(localPoolType &local_chunks, uint8_t *addr, const std::size_t size) {
+      if (size >= sizeof(local_chunk)) {
+        local_chunk*& temp = local_chunks[size];
+        temp = new (addr) local_chunk(size, temp);
+      } else if (size) {
+        *reinterpret_cast<std::size_t*>(addr) = size;
+      }
+    }
+
+    /* Punches [beg, end) out of the shared heap file (MADV_REMOVE), so the
+     * pages are freed and read back as zeros. Returns false if nothing was
+     * released. Set MPGC_KEEP_LARGE_OBJECT_PAGES to never do this. If
+     * madvise() fails (e.g. the file system can't punch holes), this
+     * process says so once and stops trying.
+     */
+    bool gc_allocator::release_pages(uint8_t *beg, uint8_t *end) {
+      static std::atomic<bool> keep_pages{ruts::env_flag("MPGC_KEEP_LARGE_OBJECT_PAGES")};
+      if (keep_pages || beg >= end) {
+        return false;
+      }
+      if (madvise(beg, end - beg, MADV_REMOVE) == 0) {
+        return true;
+      }
+      if (!keep_pages.exchange(true)) {
+        std::cerr << "mpgc: can't release the pages of large objects ("
+                  << std::strerror(errno) << "); keeping them from now on." << std::endl;
+      }
+      return false;
+    }
+
+    /* Zeroes [beg, end), except for the parts that are holes in the heap
+     * file, e.g. the pages of dead large objects given back by
+     * release_pages(). Those already read as zeros, and memset would only
+     * fault them in. If the file system can't tell us where the holes are,
+     * it all looks like data and we memset everything.
+     */
+    void gc_allocator::zero_fill(uint8_t *beg, uint8_t *end) {
+      static std::atomic<bool> no_holes{false};
+      uint8_t * const base = base_offset_ptr::base();
+      while (beg < end && _heap_fd >= 0 && !no_holes) {
+        const off_t data = lseek(_heap_fd, beg - base, SEEK_DATA);
+        if (data < 0 && errno == ENXIO) {
+          //Nothing but a hole till the end of the file.
+          return;
+        }
+        const off_t hole = data < 0 ? data : lseek(_heap_fd, data, SEEK_HOLE);
+        if (hole < 0) {
+          no_holes = true;
+          break;
+        }
+        beg = std::max(beg, base + data);
+        uint8_t *data_end = std::min(end, base + hole);
+        if (beg < data_end) {
+          std::memset(beg, 0x0, data_end - beg);
+        }
+        beg = std::max(beg, data_end);
+      }
+      if (beg < end) {
+        std::memset(beg, 0x0, end - beg);
+      }
+    }
+
+    void* gc_allocator::alloc_large(std::size_t size) {
+      gc_handshake::in_memory_thread_struct &thread_struct = *gc_handshake::thread_struct_handles.handle;
+      //Ask for enough to be able to start the object at a page boundary.
+      offset_ptr<global_chunk> c = get_from_global(size + page_size - sizeof(std::size_t));
+      assert(c->size() >= size + page_size - sizeof(std::size_t));
+
+      uint8_t *chunk = reinterpret_cast<uint8_t*>(c.as_bare_pointer());
+      uint8_t *return_addr = reinterpret_cast<uint8_t*>(align_size_up(reinterpret_cast<std::size_t>(chunk), page_size));
+      const std::size_t head_size = return_addr - chunk;
+      const std::size_t tail_size = c->size() - head_size - size;
+      /*
+       * Same as in alloc(), the chunk must be walkable at every point in case
+       * we crash. Until the head is written, the chunk's own size covers all of
+       * it, so the tail and the object's size have to be written first.
+       */
+      put_to_local(thread_struct.local_free_list, return_addr + size, tail_size);
+      *reinterpret_cast<std::size_t*>(return_addr) = size;
+      put_to_local(thread_struct.local_free_list, chunk, head_size);
+
+      if (size >= hole_check_min_size) {
+        zero_fill(return_addr + sizeof(std::size_t), return_addr + size);
+      } else {
+        std::memset(return_addr + sizeof(std::size_t), 0x0, size - sizeof(std::size_t));
+      }
+      _large_objects->insert(return_addr, thread_struct.status_idx.load().index(),
+                             memory_stats().cycle_number());
+      return return_addr;
+    }
+
     void* gc_allocator::alloc(std::size_t size) {
       local_chunk *chunk;
       std::size_t leftover_size = 0;
       size = align_size_up(size, sizeof(std::size_t));
+      if (size >= large_object_min_size && _large_objects) {
+        return alloc_large(size);
+      }
 
       localPoolType &local_chunks = gc_handshake::thread_struct_handles.handle->local_free_list;
       localPoolType::iterator it = local_chunks.lower_bound(size);
@@ -145,12 +392,7 @@ namespace mpgc {
         }
       }
       uint8_t *return_addr = reinterpret_cast<uint8_t*>(chunk);
-      if (leftover_size >= sizeof(local_chunk)) {
-        local_chunk*& temp = local_chunks[leftover_size];
-        temp = new (return_addr + size) local_chunk(leftover_size, temp);
-      } else if (leftover_size){
-        *reinterpret_cast<std::size_t*>(return_addr + size) = leftover_size;
-      }
+      put_to_local(local_chunks, return_addr + size, leftover_size);
       /*
        * It is essential to keep the size of object in the first word until it
        * gets initialized with a gc_descriptor in the allocation_epilogue function
@@ -38,6 +38,7 @@ namespace mpgc {
   extern void start_gc(Stage);
   extern void atexit_gc_handler();
   extern void assert_current_alloc_list_empty();
+  extern void retain_local_free_list(gc_handshake::in_memory_thread_struct&);
 
   namespace gc_handshake {
     per_process_struct *process_struct = nullptr;
@@ -65,8 +66,9 @@ namespace mpgc {
       assert(thread_struct.status_idx.load().index() != process_struct->global_list_index());
       assert_current_alloc_list_empty();
 
+      retain_local_free_list(thread_struct);
+      thread_struct.alloc_state.shrink();
       thread_struct.status_idx = gc_status(Signum::sigSweep, 1 - thread_struct.status_idx.load().index());
-      thread_struct.local_free_list.clear();
     }
 
     void hdl_sync(Signum sig) {
@@ -121,8 +123,9 @@ namespace mpgc {
         assert(thread_struct.status_idx.load().index() != process_struct->global_list_index());
         assert_current_alloc_list_empty();
 
+        retain_local_free_list(thread_struct);
+        thread_struct.alloc_state.shrink();
         thread_struct.status_idx = gc_status(Signum::sigSweep, 1 - thread_struct.status_idx.load().index());
-        thread_struct.clear_local_allocator = true;
       }
     }
 
@@ -150,6 +153,7 @@ namespace mpgc {
        std::abort();
       }
 #undef SIGNUM_TO_INT
+      process_struct->trace().record(trace_event::handshake_ack, static_cast<uint8_t>(siginfo->si_value.sival_int));
     }
 
     // intiailize1() is only called from mpgc::initialize().  It only be
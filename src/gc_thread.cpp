@@ -24,8 +24,13 @@
  *
  */
 
+#include <chrono>
 #include <condition_variable>
 #include <unordered_map>
+#include <sys/mman.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
 
 #include "mpgc/gc_handshake.h"
 #include "mpgc/gc_thread.h"
@@ -37,6 +42,9 @@ namespace mpgc {
   }
 
   volatile bool request_gc_termination = false;
+
+  std::atomic<const mark_bitmap*> mark_bitmap::_cached_owner{nullptr};
+  std::atomic<mark_bitmap::atomic_rep_t*> mark_bitmap::_cached_begin{nullptr};
   static std::mutex gc_termination_mutex;
   static std::condition_variable gc_terminated;
 
@@ -46,7 +54,6 @@ namespace mpgc {
                                                                                          Barrier_indices::marking1,
                                                                                          Barrier_indices::sweep1,
                                                                                          Barrier_indices::sweep2,
-                                                                                         Barrier_indices::postSweep,
                                                                                          Barrier_indices::sync};
 
   /*
@@ -88,11 +95,6 @@ namespace mpgc {
 
     gc_handshake::in_memory_thread_struct &thread_struct = *gc_handshake::thread_struct_handles.handle;
     thread_struct.sweep_signal_disabled = true;
-
-    if (thread_struct.clear_local_allocator) {
-      thread_struct.clear_local_allocator = false;
-      thread_struct.local_free_list.clear();
-    }
   }
 
   /*
@@ -140,7 +142,7 @@ namespace mpgc {
     if (thread_struct.status_idx.load().status() == gc_handshake::Signum::sigAsync) {
       cb.bitmap.mark_begin_first(ptr);
     }
-    cb.mem_stats.marked(ptr);
+    thread_struct.count_allocated(ptr->get_gc_descriptor().object_size() << 3, 1);
 
     /* We need the following signal_fence because sweep signal *must* not be
      * enabled (or processed) before marking, if we are in async phase.
@@ -155,12 +157,52 @@ namespace mpgc {
     }
   }
 
+  /*
+   * The batch counterpart of allocation_epilogue(), split in two, so that the
+   * caller can store the objects somewhere reachable in between. This installs
+   * the descriptors, starting from the last object, as the sweep must be able
+   * to walk the region at any point: until the first descriptor is in place,
+   * the size in the first word covers all of it.
+   */
+  void batch_allocation_install(void *p, gc_token &tok, std::size_t object_size, std::size_t n) {
+    uint8_t *base = static_cast<uint8_t*>(p);
+    for (std::size_t i = n; i > 0; i--) {
+      new (base + (i - 1) * object_size) gc_allocated(tok);
+      std::atomic_signal_fence(std::memory_order_release);
+    }
+  }
+
+  /*
+   * By now the objects are either reachable or the stores have marked them gray.
+   * The exception is when we got the async signal in the middle of the stores:
+   * the objects stored after it are neither. Marking them all black here covers
+   * that case as well, and the sweep can't start before we re-enable the signal.
+   */
+  void batch_allocation_epilogue(void *p, std::size_t object_size, std::size_t n) {
+    gc_handshake::in_memory_thread_struct &thread_struct = *gc_handshake::thread_struct_handles.handle;
+    gc_control_block &cb = control_block();
+
+    std::atomic_signal_fence(std::memory_order_release);
+    if (thread_struct.status_idx.load().status() == gc_handshake::Signum::sigAsync) {
+      cb.bitmap.mark_begin_first(static_cast<const gc_allocated*>(p), object_size, n);
+    }
+    thread_struct.count_allocated(object_size * n, n);
+
+    std::atomic_signal_fence(std::memory_order_release);
+
+    thread_struct.sweep_signal_disabled = false;
+    if (thread_struct.sweep_signal_requested) {
+      thread_struct.sweep_signal_requested = false;
+      gc_handshake::do_sweep_signal();
+    }
+  }
+
   /*
    * Function to capture root pointers, both, external_gc_ptrs and persistent roots.
    */
   static void capture_global_roots(Traversal_queue &q) {
     gc_control_block &cb = control_block();
-    inbound_pointers::inbound_table::table(true)->for_each_slot([&q, &cb](const offset_ptr<const gc_allocated> p) {
+    inbound_pointers::inbound_table::table(true)->for_each_root([&q, &cb](const offset_ptr<const gc_allocated> p) {
       if (p.is_valid() && !cb.bitmap.is_marked(p)) {
         //q.push_front(p);
           q.push(p);
@@ -179,6 +221,35 @@ namespace mpgc {
         });
   }
 
+  /*
+   * This process's share of a census, only touched by its GC thread. It is
+   * folded into the control block's census along with the mem_stats. Keys
+   * that don't fit in the first few slots go straight to the shared table.
+   */
+  struct local_census_entry {
+    std::uint64_t key = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t objects = 0;
+  };
+  //The table this cycle's census goes to, or nullptr if it's not a census cycle.
+  static heap_census::table *census_table = nullptr;
+  static local_census_entry local_census[heap_census::n_entries];
+
+  static void count_in_census(std::uint64_t key, std::size_t bytes) {
+    for (std::size_t i = 0, slot = heap_census::hash(key); i < 16; i++, slot = (slot + 1) % heap_census::n_entries) {
+      local_census_entry &e = local_census[slot];
+      if (e.key == 0) {
+        e.key = key;
+      }
+      if (e.key == key) {
+        e.bytes += bytes;
+        e.objects++;
+        return;
+      }
+    }
+    census_table->add(key, bytes, 1);
+  }
+
   /*
    * The main function that marks black an object. It enumerates all the pointers in the object and
    * then marks it.
@@ -210,11 +281,11 @@ namespace mpgc {
      * unfinished work of this process, will mark it.
      */
     cb.bitmap.mark_end_first(p);
-    // We should probably do this in the per-process struct and sweep
-    // the total into the global when we try to increment the cycle
-    // number, but that's more bookkeeping and it might be more work
-    // to get the reference to the per-process struct.
-    cb.mem_stats.marked(p);
+    const std::size_t bytes = p->get_gc_descriptor().object_size() << 3;
+    gc_handshake::process_struct->count_marked(bytes);
+    if (census_table) {
+      count_in_census(p->get_gc_descriptor().type_key(), bytes);
+    }
   }
 
   /*
@@ -234,6 +305,7 @@ namespace mpgc {
     while (!cb.barrier_sync[n].compare_exchange_weak(i, i + 1));
     //assert(i <= cb.total_process_count.load().count);
     p.set_barrier_incremented();
+    p.trace().record(trace_event::barrier_inc, uint8_t(n), std::uint32_t(i));
   }
 
   /*
@@ -304,6 +376,7 @@ namespace mpgc {
       } else if (binfo._info._barrier_idx == next_barrier_index_mapping[gc_handshake::process_struct->get_barrier_index()]) {
         return 0;
       } else if (per_process_struct::get_creation_time(old_liveness.pid) != old_liveness.creation_time) {
+        gc_handshake::process_struct->trace().record(trace_event::dead_process, 0, std::uint32_t(old_liveness.pid));
         if (binfo._info._barrier_idx != gc_handshake::process_struct->get_barrier_index()) {
           //The following commented code is required only if there is a possibility of the same barrier is used back-to-back.
           //proc.reset_barrier_info(proc.get_barrier_index());
@@ -392,6 +465,7 @@ namespace mpgc {
                   binfo._info._barrier_idx == Barrier_indices::marking2)) {
         return 0;
       } else if (per_process_struct::get_creation_time(old_liveness.pid) != old_liveness.creation_time) {
+        gc_handshake::process_struct->trace().record(trace_event::dead_process, 0, std::uint32_t(old_liveness.pid));
         per_process_struct &proc = *p;
         per_process_struct::liveness desired = gc_handshake::process_struct->get_liveness();
         if (proc.set_liveness(old_liveness, desired)) {
@@ -500,6 +574,8 @@ namespace mpgc {
 
       while (p->steal(q)) {
         helped = true;
+        cb.telemetry.steals.fetch_add(1, std::memory_order_relaxed);
+        process_struct.trace().record(trace_event::steal, 0, std::uint32_t(p->get_liveness().pid));
         empty_collector_stack(cb, process_struct, q);
         if (request_gc_termination) {
           return helped;
@@ -714,10 +790,14 @@ namespace mpgc {
     assert(begin == end);
   }
 
-  static void put_to_global(gc_allocator::globalListType& list, const std::size_t beg_word, const std::size_t size_in_bytes) {
+  //Bytes handed to the global list by this process's sweep in the current cycle.
+  static std::size_t swept_bytes = 0;
+
+  static void put_to_global(gc_allocator::chunk_batch& batch, const std::size_t beg_word, const std::size_t size_in_bytes) {
     if (size_in_bytes == 0) {
       return;
     }
+    swept_bytes += size_in_bytes;
     std::size_t *begin = reinterpret_cast<std::size_t*>(base_offset_ptr::base()) + beg_word;
     if (size_in_bytes < sizeof(gc_allocator::global_chunk)) {
       *begin = size_in_bytes;
@@ -725,8 +805,7 @@ namespace mpgc {
     }
     erase_gc_descriptors_from_free_chunk(reinterpret_cast<gc_allocated*>(begin), size_in_bytes >> 3);
 
-    gc_allocator::put_to_global(list, size_in_bytes,
-                                new (begin) gc_allocator::global_chunk(size_in_bytes));
+    batch.add(size_in_bytes, new (begin) gc_allocator::global_chunk(size_in_bytes));
   }
 
   void sweep1_phase() {
@@ -735,34 +814,89 @@ namespace mpgc {
     Pre_sweep_list &pre_sweep_list = gc_handshake::process_struct->pre_sweep_list();
     bool work_done = false;
     assert(pre_sweep_list.empty());
-    for (uint8_t i = gc_allocator::global_list_size(); !work_done && i > 5; i--) {
-      do {
-        if (request_gc_termination) {
-          return;
-        }
-        offset_ptr<gc_allocator::global_chunk> c = gc_allocator::get_chunk_from_global(other_list, i - 1);
-        if (c == nullptr) {
-          break;
-        } else {
-          work_done = true;
-        }
-        std::size_t beg_word, end_word;
-        if (cb.bitmap.expand_free_chunk(c, c->size(), beg_word, end_word)) {
-          /* We have to be carefull here. We are pushing beg_word and end_word as
-           * two different iteruts in the deque. But they are really meant for single
-           * operation. Therefore, while taking them out, firstly, the size of deque
-           * should be in multiples of two. And, secondly, two pop operations should
-           * be done from the other front to retrieve the beg_word and end_word in
-           * right order.
-           */
-          pre_sweep_list.push_back(beg_word);
-          pre_sweep_list.push_back(end_word);
-        }
-      } while(true);
+    //Only the chunks of 512 bytes or more are expanded.
+    const uint8_t smallest_list = gc_allocator::global_list_index_for(512);
+    for (uint8_t i = gc_allocator::global_list_size(); !work_done && i > smallest_list; i--) {
+      for (gc_allocator::shardListType &shard : other_list) {
+        do {
+          if (request_gc_termination) {
+            return;
+          }
+          offset_ptr<gc_allocator::global_chunk> c = gc_allocator::get_chunk_from_global(shard, i - 1);
+          if (c == nullptr) {
+            break;
+          } else {
+            work_done = true;
+          }
+          std::size_t beg_word, end_word;
+          if (cb.bitmap.expand_free_chunk(c, c->size(), beg_word, end_word)) {
+            /* We have to be carefull here. We are pushing beg_word and end_word as
+             * two different iteruts in the deque. But they are really meant for single
+             * operation. Therefore, while taking them out, firstly, the size of deque
+             * should be in multiples of two. And, secondly, two pop operations should
+             * be done from the other front to retrieve the beg_word and end_word in
+             * right order.
+             */
+            pre_sweep_list.push_back(beg_word);
+            pre_sweep_list.push_back(end_word);
+          }
+        } while(true);
+      }
+    }
+  }
+
+  /*
+   * Size of a large object from the table, or 0 if it no longer looks like
+   * the large object it was tracked as. The object may have died before its
+   * descriptor was constructed, in which case the first word is the size.
+   */
+  static std::size_t large_object_size(const offset_ptr<const gc_allocated> &p) {
+    const std::size_t *b = reinterpret_cast<const std::size_t*>(p.as_bare_pointer());
+    const std::size_t size = *b > base_offset_ptr::heap_size() ? p->get_gc_descriptor().object_size() << 3 : *b;
+    const std::size_t offset = reinterpret_cast<const uint8_t*>(b) - base_offset_ptr::base();
+    if (size < gc_allocator::large_object_min_size || size > base_offset_ptr::heap_size() - offset) {
+      return 0;
     }
+    return size;
+  }
+
+  /*
+   * Gives the pages of the dead large objects back to the OS (see
+   * gc_allocator::release_pages()). This must happen after the flip, so
+   * that nobody allocates from the old list anymore, and before sweep2
+   * starts handing out the free space. The first page is kept, as sweep
+   * walks the free space object by object using the size in the first word.
+   *
+   * The logical chunks that lie entirely inside a live large object have
+   * nothing to sweep, so they are marked as swept here and sweep2 skips
+   * them, the same way it does for the pre-sweep list.
+   */
+  static void release_dead_large_objects(const bool set_bit) {
+    gc_control_block &cb = control_block();
+    cb.large_objects.sweep(1 - gc_handshake::process_struct->global_list_index(),
+                           cb.mem_stats.cycle_number(),
+                           [&cb, set_bit](const offset_ptr<const gc_allocated> &p) {
+                             if (!cb.bitmap.is_marked(p)) {
+                               return false;
+                             }
+                             const std::size_t size = large_object_size(p);
+                             if (size > 0) {
+                               const std::size_t beg_word = (reinterpret_cast<const uint8_t*>(p.as_bare_pointer()) - base_offset_ptr::base()) >> 3;
+                               cb.bitmap.set_sweep_bitmap_range(beg_word, beg_word + (size >> 3) - 1, set_bit);
+                             }
+                             return true;
+                           },
+                           [](const offset_ptr<const gc_allocated> &p) {
+                             const std::size_t size = large_object_size(p);
+                             if (size == 0) {
+                               return;
+                             }
+                             uint8_t *b = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(p.as_bare_pointer()));
+                             gc_allocator::release_pages(b + gc_allocator::page_size, b + (size & ~(gc_allocator::page_size - 1)));
+                           });
   }
 
-  void mark_bitmap::process_logical_chunk(gc_allocator::globalListType &list, const std::size_t nr_chunk, const bool set_bit) {
+  void mark_bitmap::process_logical_chunk(gc_allocator::chunk_batch &batch, const std::size_t nr_chunk, const bool set_bit) {
     std::size_t first = 0;
     const std::size_t end = (nr_chunk + 1) << (chunk_size_log_bits + value_log_bits);
     std::size_t second;
@@ -772,10 +906,10 @@ namespace mpgc {
       if (second == end) {
         set_sweep_bitmap_both(0, set_bit);
         second = process_next_chunk_begin(1, set_bit);
-        put_to_global(list, first, (second - first) << 3);
+        put_to_global(batch, first, (second - first) << 3);
         return;
       } else {
-        put_to_global(list, first, (second - first) << 3);
+        put_to_global(batch, first, (second - first) << 3);
       }
     } else {
       second = nr_chunk << (chunk_size_log_bits + value_log_bits);
@@ -785,7 +919,7 @@ namespace mpgc {
     while (second < end) {
       first = find_next_free_word(second, end, dirty_end_bitmap);
       if (first == end) {
-        rep_t B = _end[((nr_chunk + 1) << chunk_size_log_bits) - 1];
+        rep_t B = end_bitmap()[((nr_chunk + 1) << chunk_size_log_bits) - 1];
         if (B & 0x1) {
           //If the last word of this chunk was end of an object, then we have to process the next chunk's _begin
           second = process_next_chunk_begin(nr_chunk + 1, set_bit);
@@ -798,7 +932,7 @@ namespace mpgc {
           second = process_next_chunk_begin(nr_chunk + 1, set_bit);
         }
       }
-      put_to_global(list, first, (second - first) << 3);
+      put_to_global(batch, first, (second - first) << 3);
     }
 
     if (!dirty_end_bitmap) {
@@ -809,27 +943,28 @@ namespace mpgc {
   void mark_bitmap::_set_sweep_bitmap_range(const std::size_t start_chunk, const std::size_t finish_chunk, const bool set) {
     std::size_t start_word_idx = start_chunk >> value_log_bits;
     const std::size_t finish_word_idx = finish_chunk >> value_log_bits;
+    atomic_rep_t *sweep_begin = sweep_bitmap_begin(), *sweep_end = sweep_bitmap_end();
 
     const rep_t first_chunk_desired = (rep_t(1) << (bits_per_value - (start_chunk & (bits_per_value - 1)))) - 1;
     const rep_t last_chunk_desired = ~(construct_bitmap_word(finish_chunk & (bits_per_value - 1)) - 1);
 
     if (start_word_idx == finish_word_idx) {
-      set_sweep_bitmap(_sweep_bitmap_end[start_word_idx], first_chunk_desired & last_chunk_desired, set);
-      set_sweep_bitmap(_sweep_bitmap_begin[start_word_idx], first_chunk_desired & last_chunk_desired, set);
+      set_sweep_bitmap(sweep_end[start_word_idx], first_chunk_desired & last_chunk_desired, set);
+      set_sweep_bitmap(sweep_begin[start_word_idx], first_chunk_desired & last_chunk_desired, set);
       return;
     }
 
-    set_sweep_bitmap(_sweep_bitmap_end[start_word_idx], first_chunk_desired, set);
-    set_sweep_bitmap(_sweep_bitmap_begin[start_word_idx], first_chunk_desired, set);
+    set_sweep_bitmap(sweep_end[start_word_idx], first_chunk_desired, set);
+    set_sweep_bitmap(sweep_begin[start_word_idx], first_chunk_desired, set);
 
     const rep_t word_to_write = set ? rep_t(-1) : 0;
     for (start_word_idx++; start_word_idx < finish_word_idx; start_word_idx++) {
-      _sweep_bitmap_end[start_word_idx] = word_to_write;
-      _sweep_bitmap_begin[start_word_idx] = word_to_write;
+      sweep_end[start_word_idx] = word_to_write;
+      sweep_begin[start_word_idx] = word_to_write;
     }
 
-    set_sweep_bitmap(_sweep_bitmap_end[finish_word_idx], last_chunk_desired, set);
-    set_sweep_bitmap(_sweep_bitmap_begin[finish_word_idx], last_chunk_desired, set);
+    set_sweep_bitmap(sweep_end[finish_word_idx], last_chunk_desired, set);
+    set_sweep_bitmap(sweep_begin[finish_word_idx], last_chunk_desired, set);
   }
 
   void mark_bitmap::set_sweep_bitmap_range(const std::size_t beg_word, const std::size_t end_word, const bool set_bit) {
@@ -847,6 +982,7 @@ namespace mpgc {
     std::size_t &i = gc_handshake::process_struct->get_tolerate_sweep_chunk();
     gc_control_block &cb = control_block();
     gc_allocator::globalListType &list = cb.global_free_list[gc_handshake::process_struct->global_list_index()];
+    gc_allocator::chunk_batch batch;
 
     {
       Pre_sweep_list &pre_sweep_list = gc_handshake::process_struct->pre_sweep_list();
@@ -858,9 +994,10 @@ namespace mpgc {
         std::size_t end_word = pre_sweep_list.front();
         pre_sweep_list.pop_front();
 
-        put_to_global(list, beg_word, (end_word - beg_word) << 3);
+        put_to_global(batch, beg_word, (end_word - beg_word) << 3);
 
         if (request_gc_termination) {
+          batch.flush(list);
           return;
         }
         /* We can set all the bits within the chunk to be set as they will not
@@ -868,6 +1005,7 @@ namespace mpgc {
          */
         cb.bitmap.set_sweep_bitmap_range(beg_word, end_word - 1, set_bitmap);
       }
+      batch.flush(list);
     }
 
     do {
@@ -878,62 +1016,56 @@ namespace mpgc {
       if (i >= _total_logical_chunks) {
         break;
       }
+      /* Clearing the idle copy is idempotent, so it is done before sweeping
+       * the chunk. That way the recovery code can simply redo it.
+       */
+      clear_idle_chunk(i, set_bitmap);
       if (!is_end_sweep_bitmap_set(i, set_bitmap)) {
-        process_logical_chunk(list, i, set_bitmap);
+        process_logical_chunk(batch, i, set_bitmap);
+        batch.flush(list);
       }
     } while (true);
     //The following clearing of the other global allocator will not be required once we have the optimized sweep code.
     gc_allocator::globalListType &other_list = cb.global_free_list[1 - gc_handshake::process_struct->global_list_index()];
-    for (uint8_t i = 0; i < gc_allocator::global_list_size(); i++) {
-      other_list[i].store(gc_allocator::list_head());
-      assert(other_list[i].load().empty());
+    for (gc_allocator::shardListType &shard : other_list) {
+      for (uint8_t i = 0; i < gc_allocator::global_list_size(); i++) {
+        shard[i].store(gc_allocator::list_head());
+        assert(shard[i].load().empty());
+      }
     }
   }
 
-  void mark_bitmap::_post_sweep_clear(atomic_rep_t &word, atomic_rep_t * bitmap_chunk, const bool set_bit) {
-    rep_t val = word;
-    rep_t iter = construct_bitmap_word(0);
-    const std::size_t size = sizeof(atomic_rep_t) << chunk_size_log_bits;
-    if (!set_bit) {
-      val = ~val;
-    }
-    while (iter) {
-      if (!(val & iter)) {
-        std::memset(bitmap_chunk, 0x0, size);
-        set_sweep_bitmap(word, iter, set_bit);
-      }
-      iter >>= 1;
-      bitmap_chunk += 1 << chunk_size_log_bits;
+  /* The idle copy was swept in the previous cycle with !set_bit. So the
+   * chunks which are still dirty have their sweep bit equal to set_bit.
+   * Such a chunk is cleared, and the rest are just toggled so that all the
+   * bits become equal to set_bit, which is what the next sweep of this copy
+   * (with !set_bit) expects.
+   */
+  void mark_bitmap::_clear_idle_chunk(atomic_rep_t &word, atomic_rep_t *bitmap_chunk, const rep_t bit, const bool set_bit) {
+    const rep_t val = word;
+    if (set_bit ? val & bit : ~val & bit) {
+      std::memset(bitmap_chunk, 0x0, sizeof(atomic_rep_t) << chunk_size_log_bits);
+    } else {
+      set_sweep_bitmap(word, bit, set_bit);
     }
   }
 
-  void mark_bitmap::post_sweep_clear(const std::size_t nr_sweep_bitmap_word, const bool set_bit) {
-    if (nr_sweep_bitmap_word >= _total_logical_chunks) {
+  void mark_bitmap::clear_idle_chunk(const std::size_t nr_chunk, const bool set_bit) {
+    if (nr_chunk >= _total_logical_chunks) {
       /* This is possible if a process terminates after finishing
-       * sweep_phase2 but before fetching first bitmap word.
+       * sweep2_phase but before reaching the barrier.
        */
       return;
     }
-    assert(nr_sweep_bitmap_word < _sweep_bitmap_size);
-    const std::size_t word_begin = nr_sweep_bitmap_word << (value_log_bits + chunk_size_log_bits);
-    _post_sweep_clear(_sweep_bitmap_begin[nr_sweep_bitmap_word], _begin + word_begin, set_bit);
-    _post_sweep_clear(_sweep_bitmap_end[nr_sweep_bitmap_word], _end + word_begin, set_bit);
-  }
-
-  void mark_bitmap::post_sweep_phase(per_process_struct *process_struct, const bool set_bit) {
-    assert(gc_handshake::process_struct->get_tolerate_sweep_chunk() >= _total_logical_chunks);
-
-    std::size_t &i = gc_handshake::process_struct->get_tolerate_sweep_chunk();
-    do {
-      if (request_gc_termination) {
-        break;
-      }
-      fetch_sweep_bitmap_word_to_process(i);
-      if (i >= _sweep_bitmap_size) {
-        break;
-      }
-      post_sweep_clear(i, set_bit);
-    } while (true);
+    atomic_rep_t *idle = idle_bitmap();
+    atomic_rep_t *idle_end = idle + _size;
+    atomic_rep_t *idle_sweep_begin = idle_end + _size;
+    atomic_rep_t *idle_sweep_end = idle_sweep_begin + _sweep_bitmap_size;
+    const std::size_t word = nr_chunk >> value_log_bits;
+    const rep_t bit = construct_bitmap_word(nr_chunk & (bits_per_value - 1));
+    const std::size_t offset = nr_chunk << chunk_size_log_bits;
+    _clear_idle_chunk(idle_sweep_begin[word], idle + offset, bit, set_bit);
+    _clear_idle_chunk(idle_sweep_end[word], idle_end + offset, bit, set_bit);
   }
 
   static bool cleanup_sweep1_phase(per_process_struct *p, per_process_struct::liveness &expected) {
@@ -996,16 +1128,32 @@ namespace mpgc {
     return false;
   }
 
+  /*
+   * A process that dies before it gets to fold_mem_stats() leaves its marked
+   * and allocation counts behind. Whoever notices it is dead folds them
+   * instead.
+   */
+  static void fold_dead_process_stats(per_process_struct *p) {
+    std::size_t bytes = 0, n = 0;
+    p->take_marked(bytes, n);
+    p->take_allocated(bytes, n);
+    if (n != 0) {
+      control_block().mem_stats.marked(bytes, n);
+    }
+  }
+
   /*
    * Cleanup function called for a crashed process for recovery. After cleanup,
    * it restores the ownserhip of the dead process' structure that is taken
    * before the cleanup.
    */
-  static bool cleanup_post_sweep_phase(per_process_struct *p, per_process_struct::liveness &expected, const bool set_bit) {
+  static bool cleanup_sweep2_phase(per_process_struct *p, per_process_struct::liveness &expected, const bool set_bit) {
     per_process_struct::liveness desired = gc_handshake::process_struct->get_liveness();
     if (p->set_liveness(expected, desired)) {
-      control_block().bitmap.post_sweep_clear(p->get_tolerate_sweep_chunk(), set_bit);
+      //The dead process may have been in the middle of clearing the idle copy of this chunk.
+      control_block().bitmap.clear_idle_chunk(p->get_tolerate_sweep_chunk(), set_bit);
       p->reset_tolerate_sweep_chunk();
+      fold_dead_process_stats(p);
       expected.is_live = per_process_struct::Alive::Dead;
       bool assert_test = p->set_liveness(desired, expected);
       assert(assert_test);
@@ -1033,7 +1181,6 @@ namespace mpgc {
       case Barrier_indices::sync:
       case Barrier_indices::preMarking:
       case Barrier_indices::preSweep:
-      case Barrier_indices::sweep2:
         temp_live_process = cleanup_failures(action_on_dead_process,
                                              [](per_process_struct *p, per_process_struct::liveness &expected) -> bool {
             p->mark_dead();
@@ -1043,8 +1190,12 @@ namespace mpgc {
       case Barrier_indices::sweep1:
         temp_live_process = cleanup_failures(action_on_dead_process, cleanup_sweep1_phase);
         break;
-      case Barrier_indices::postSweep:
-        temp_live_process = cleanup_failures(action_on_dead_process, cleanup_post_sweep_phase, set_bit);
+      case Barrier_indices::sweep2:
+        temp_live_process = cleanup_failures([](per_process_struct *p) {
+                                               p->mark_dead();
+                                               fold_dead_process_stats(p);
+                                             },
+                                             cleanup_sweep2_phase, set_bit);
         break;
       default:
         /* marking1 and marking2 will not come here as they are related to marking and
@@ -1073,11 +1224,103 @@ namespace mpgc {
   void assert_current_alloc_list_empty() {
     gc_allocator::globalListType &list =
           control_block().global_free_list[1 - gc_handshake::thread_struct_handles.handle->status_idx.load().index()];
-    for (uint8_t i = 0; i < gc_allocator::global_list_size(); i++) {
-      assert(list[i].load().empty());
+    for (gc_allocator::shardListType &shard : list) {
+      for (uint8_t i = 0; i < gc_allocator::global_list_size(); i++) {
+        assert(shard[i].load().empty());
+      }
+    }
+  }
+
+
+  /*
+   * Called at the sweep handshake, before the thread switches to the other
+   * global list. Instead of dropping the local chunks, which the sweep would
+   * then hand out again, we mark them live in the bitmap the sweep is going to
+   * use. The thread keeps allocating from them, and they stay out of the global
+   * list. They are not marked in the next cycle's bitmap, so if the thread dies,
+   * the next sweep reclaims them.
+   */
+  void retain_local_free_list(gc_handshake::in_memory_thread_struct &thread_struct) {
+    mark_bitmap &bitmap = control_block().bitmap;
+    for (const auto &entry : thread_struct.local_free_list) {
+      for (gc_allocator::local_chunk *c = entry.second; c; c = c->next()) {
+        bitmap.mark_local_chunk(c, entry.first);
+      }
+    }
+  }
+
+  /*
+   * Folds this process's marking counts and its threads' allocation counts
+   * into the global stats. Done before the sweep2 barrier, so that every
+   * process is in by the time the cycle number gets bumped.
+   */
+  static void fold_mem_stats() {
+    gc_control_block &cb = control_block();
+    std::size_t bytes = 0, n = 0;
+    gc_handshake::process_struct->take_marked(bytes, n);
+    cb.telemetry.bytes_marked.record(bytes);
+    cb.telemetry.bytes_swept_to_lists.record(swept_bytes);
+    swept_bytes = 0;
+    gc_handshake::process_struct->take_allocated(bytes, n);
+    cb.mem_stats.marked(bytes, n);
+    //Anyone who died earlier in the cycle has been marked dead by now.
+    for (per_process_struct *p = cb.process_struct_list.head(); p; p = cb.process_struct_list.next(p)) {
+      if (per_process_struct::is_marked(p)) {
+        fold_dead_process_stats(p);
+      }
+    }
+
+    if (census_table) {
+      for (local_census_entry &e : local_census) {
+        if (e.key != 0) {
+          census_table->add(e.key, e.bytes, e.objects);
+          e = local_census_entry();
+        }
+      }
     }
   }
 
+  static std::uint64_t ns_since(const std::chrono::steady_clock::time_point &start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  const bool trace_events_enabled = !ruts::env_flag("MPGC_NO_TRACE_EVENTS");
+
+  static void trace_phase(trace_event e, gc_phase p) {
+    gc_handshake::process_struct->trace().record(e, uint8_t(p));
+  }
+
+  //The phase a GC thread starts with when it (re)enters start_gc at the given stage.
+  static gc_phase first_phase(Stage s) {
+    switch (s) {
+    case Stage::Sweeped:     return gc_phase::sync1;
+    case Stage::preTracing:  return gc_phase::sync2;
+    case Stage::Tracing:     return gc_phase::async;
+    case Stage::Traced:      return gc_phase::flip;
+    case Stage::preSweeping: return gc_phase::sweep1;
+    default:                 return gc_phase::sweep2;
+    }
+  }
+
+  //Also enters the next phase, unless this is the last one in the cycle.
+  static void end_phase(gc_phase p, std::chrono::steady_clock::time_point &start) {
+    control_block().telemetry.phase(p).record(ns_since(start));
+    trace_phase(trace_event::phase_exit, p);
+    if (p != gc_phase::sweep2) {
+      trace_phase(trace_event::phase_enter, gc_phase(uint8_t(p) + 1));
+    }
+    start = std::chrono::steady_clock::now();
+  }
+
+  static void timed_handshake(gc_handshake::Signum sig) {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    gc_handshake::handshake(sig);
+    control_block().telemetry.handshake_ns.record(ns_since(start));
+  }
+
+  void record_allocation_stall(std::uint64_t ns) {
+    control_block().telemetry.allocation_stall_ns.record(ns);
+  }
 
   void trace_gc_cycle(int n, const gc_control_block &cb) {
     static const bool tracep = ruts::env_flag("GC_TRACE_CYCLES");
@@ -1123,6 +1366,8 @@ namespace mpgc {
 
     while (true) {
       trace_gc_cycle(count, cb);
+      std::chrono::steady_clock::time_point phase_start = std::chrono::steady_clock::now();
+      trace_phase(trace_event::phase_enter, first_phase(local_stage));
       switch (local_stage) {
       case Stage::Sweeped: {
         local_status.status_idx.status = gc_handshake::Signum::sigSweep;
@@ -1134,7 +1379,7 @@ namespace mpgc {
         gc_handshake::process_struct->set_gc_status(local_status.data);
         assert(gc_handshake::process_struct->get_gc_status() == cb.status.load().data);
 
-        gc_handshake::handshake(gc_handshake::Signum::sigSync1);
+        timed_handshake(gc_handshake::Signum::sigSync1);
         if (request_gc_termination) {
           break;
         }
@@ -1144,6 +1389,7 @@ namespace mpgc {
 
         cb.stage.compare_exchange_strong(local_stage, Stage::preTracing);
         local_stage = Stage::preTracing;
+        end_phase(gc_phase::sync1, phase_start);
       }
       case Stage::preTracing: {
         //All GC threads must synchronize at this point.
@@ -1163,13 +1409,14 @@ namespace mpgc {
         gc_handshake::process_struct->set_gc_status(local_status.data);
         assert(gc_handshake::process_struct->get_gc_status() == cb.status.load().data);
 
-        gc_handshake::handshake(gc_handshake::Signum::sigSync2);
+        timed_handshake(gc_handshake::Signum::sigSync2);
         if (request_gc_termination) {
           break;
         }
 
         cb.stage.compare_exchange_strong(local_stage, Stage::Tracing);
         local_stage = Stage::Tracing;
+        end_phase(gc_phase::sync2, phase_start);
       }
       case Stage::Tracing: {
         //All GC threads must synchronize at this point.
@@ -1178,8 +1425,8 @@ namespace mpgc {
           break;
         }
         cb.barrier_sync[Barrier_indices::sweep2] = 0;
-        cb.barrier_sync[Barrier_indices::postSweep] = 0;
         cb.bitmap.reset_logical_chunk_count();
+        census_table = cb.census.due(gc_cycle_num) ? &cb.census.counting(gc_cycle_num) : nullptr;
 
         local_status.status_idx.status = gc_handshake::Signum::sigSync2;
         if (cb.status.compare_exchange_strong(local_status,
@@ -1190,12 +1437,15 @@ namespace mpgc {
         gc_handshake::process_struct->set_gc_status(local_status.data);
         assert(gc_handshake::process_struct->get_gc_status() == cb.status.load().data);
 
+        const std::chrono::steady_clock::time_point handshake_start = std::chrono::steady_clock::now();
         gc_handshake::post_handshake(gc_handshake::Signum::sigAsync);
         capture_global_roots(gc_handshake::process_struct->traversal_queue());
         gc_handshake::wait_handshake(gc_handshake::Signum::sigAsync);
         if (request_gc_termination) {
           break;
         }
+        cb.telemetry.handshake_ns.record(ns_since(handshake_start));
+        end_phase(gc_phase::async, phase_start);
 
         marking_phase(*gc_handshake::process_struct);
         if (request_gc_termination) {
@@ -1206,6 +1456,7 @@ namespace mpgc {
 
         cb.stage.compare_exchange_strong(local_stage, Stage::Traced);
         local_stage = Stage::Traced;
+        end_phase(gc_phase::marking, phase_start);
       }
       case Stage::Traced: {
         local_status.status_idx.status = gc_handshake::Signum::sigAsync;
@@ -1217,13 +1468,14 @@ namespace mpgc {
         gc_handshake::process_struct->set_gc_status(local_status.data);
         assert(gc_handshake::process_struct->get_gc_status() == cb.status.load().data);
 
-        gc_handshake::handshake(gc_handshake::Signum::sigSweep);
+        timed_handshake(gc_handshake::Signum::sigSweep);
         if (request_gc_termination) {
           break;
         }
 
         cb.stage.compare_exchange_strong(local_stage, Stage::preSweeping);
         local_stage = Stage::preSweeping;
+        end_phase(gc_phase::flip, phase_start);
       }
       case Stage::preSweeping: {
         //All GC threads must synchronize at this point.
@@ -1234,9 +1486,11 @@ namespace mpgc {
         cb.barrier_sync[Barrier_indices::preMarking] = 0;
 
         sweep1_phase();
+        release_dead_large_objects(local_status.status_idx.idx);
 
         cb.stage.compare_exchange_strong(local_stage, Stage::Sweeping);
         local_stage = Stage::Sweeping;
+        end_phase(gc_phase::sweep1, phase_start);
       }
       case Stage::Sweeping: {
         synchronize_gc_threads(Barrier_indices::sweep1, local_stage);
@@ -1248,26 +1502,20 @@ namespace mpgc {
         if (request_gc_termination) {
           break;
         }
+        fold_mem_stats();
 
         synchronize_gc_threads(Barrier_indices::sweep2, local_stage, local_status.status_idx.idx);
         if (request_gc_termination) {
           break;
         }
-
-        cb.bitmap.post_sweep_phase(gc_handshake::process_struct, local_status.status_idx.idx);
-        if (request_gc_termination) {
-          break;
-        }
-
-        synchronize_gc_threads(Barrier_indices::postSweep, local_stage, local_status.status_idx.idx);
-        if (request_gc_termination) {
-          break;
-        }
         gc_handshake::process_struct->reset_tolerate_sweep_chunk();
-        //cb.bitmap.test_bitmaps(local_status.status_idx.idx);
+
+        //The copy cleared during this sweep will be used for marking in the next cycle.
+        cb.bitmap.select_marking_bitmap(local_status.status_idx.idx, true);
 
         cb.stage.compare_exchange_strong(local_stage, Stage::Sweeped);
         local_stage = Stage::Sweeped;
+        end_phase(gc_phase::sweep2, phase_start);
 
         gc_handshake::thread_struct_list.deletion(gc_handshake::in_memory_thread_struct::is_marked);
         cb.process_struct_list.deletion(gc_handshake::process_struct, per_process_struct::is_marked);
@@ -1287,7 +1535,12 @@ namespace mpgc {
       // This may not be the appropriate place to put this.  We want
       // it at a point where nobody's marking yet and everybody's
       // finished marking.
+      const std::size_t finished_cycle = gc_cycle_num;
       gc_cycle_num = cb.mem_stats.inc_cycle_num_to(gc_cycle_num+1);
+      if (census_table) {
+        cb.census.publish(finished_cycle);
+        census_table = nullptr;
+      }
     } //while(true)
   }
 
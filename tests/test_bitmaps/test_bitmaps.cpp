@@ -0,0 +1,84 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <cstdlib>
+#include "mpgc/gc.h"
+#include "mpgc/gc_thread.h"
+
+using namespace mpgc;
+using namespace std;
+
+namespace {
+  //64 logical chunks, so every bit of the sweep bitmaps is in use.
+  constexpr size_t heap_bytes = size_t(32) << 20;
+  constexpr size_t object_bytes = 32;
+
+  offset_ptr<const gc_allocated> at(size_t offset) {
+    return reinterpret_cast<const gc_allocated *>(base_offset_ptr::base() + offset);
+  }
+
+  void check(bool cond, const char *what) {
+    cout << (cond ? "ok:     " : "FAILED: ") << what << endl;
+    if (!cond) {
+      exit(1);
+    }
+  }
+}
+
+int main() {
+  initialize();
+  mark_bitmap bm(heap_bytes);
+  check(bm.logical_chunk_count() == 64, "logical chunk count");
+
+  bm.select_marking_bitmap(0, true);
+  bm.mark_begin_first(at(4096), object_bytes, 100);
+  check(bm.is_marked(at(4096)), "first object marked");
+  check(bm.is_marked(at(4096 + 99 * object_bytes)), "last object marked");
+  check(!bm.is_marked(at(4096 + 100 * object_bytes)), "next object not marked");
+
+  //Switch copies, the marks stay behind in what is now the idle copy.
+  bm.select_marking_bitmap(1, true);
+  check(!bm.is_marked(at(4096)), "marks not visible after the switch");
+  check(!bm.idle_copy_is_clear(false), "idle copy dirty");
+
+  for (size_t i = 0; i < bm.logical_chunk_count(); i++) {
+    bm.clear_idle_chunk(i, false);
+  }
+  check(bm.idle_copy_is_clear(false), "idle copy cleared");
+  //A chunk that's already clean just gets its sweep bit toggled.
+  for (size_t i = 0; i < bm.logical_chunk_count(); i++) {
+    bm.clear_idle_chunk(i, true);
+  }
+  check(bm.idle_copy_is_clear(true), "idle copy sweep bits toggled");
+
+  //Same thing through _copy rather than the cached pointer.
+  bm.mark_begin_first(at(8192), object_bytes, 1);
+  bm.select_marking_bitmap(0);
+  check(!bm.is_marked(at(4096)), "cleared copy has no stale marks");
+  check(!bm.is_marked(at(8192)), "marks in copy 1 not visible");
+  bm.select_marking_bitmap(1);
+  check(bm.is_marked(at(8192)), "marks in copy 1 visible again");
+}
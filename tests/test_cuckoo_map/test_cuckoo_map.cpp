@@ -0,0 +1,149 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "mpgc/gc.h"
+#include "mpgc/gc_cuckoo_map.h"
+
+using namespace mpgc;
+using namespace std;
+
+namespace {
+  //Four small segments per table, so they grow over and over, and
+  //lookups keep running into segments that are partly migrated.
+  using map_type = gc_cuckoo_map<uint64_t, uint64_t, ruts::hash1<uint64_t>, ruts::hash2<uint64_t>, 2>;
+
+  constexpr uint64_t n = 50000;
+  constexpr uint64_t n_prefill = 1000;
+  constexpr unsigned n_writers = 4;
+  constexpr unsigned n_readers = 2;
+
+  //Never zero, which is what get() says for a missing key.
+  uint64_t val(uint64_t k) {
+    return 2 * k + 1;
+  }
+
+  void check(bool cond, const char *what) {
+    cout << (cond ? "ok:     " : "FAILED: ") << what << endl;
+    if (!cond) {
+      exit(1);
+    }
+  }
+
+  bool holds_all(const gc_ptr<map_type> &m, uint64_t from, uint64_t to) {
+    for (uint64_t k = from; k < to; k++) {
+      if (m->get(k) != val(k)) {
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+int main() {
+  initialize();
+
+  //Without the background migrator, the operations that run into growing
+  //segments finish the migrations a batch at a time.
+  gc_ptr<map_type> m = make_gc<map_type>(16);
+  bool found = true;
+  for (uint64_t k = 0; k < n; k++) {
+    m->put(k, val(k));
+    found = found && m->get(k / 2) == val(k / 2) && m->get(k) == val(k);
+  }
+  check(found, "keys visible while segments migrate");
+  check(holds_all(m, 0, n), "all keys there once growing stops");
+  check(!m->contains(n) && m->get(n) == 0, "missing key missing");
+
+  //With it, while writers grow the map and readers look at keys that are
+  //there throughout.
+  background_migrator::start();
+  check(background_migrator::running(), "background migrator running");
+  gc_ptr<map_type> cm = make_gc<map_type>(16);
+  for (uint64_t k = 0; k < n_prefill; k++) {
+    cm->put(k, val(k));
+  }
+  atomic<bool> writing{true};
+  atomic<bool> readers_ok{true};
+  vector<thread> threads;
+  for (unsigned r = 0; r < n_readers; r++) {
+    threads.emplace_back([&] {
+        initialize_thread();
+        while (writing) {
+          if (!holds_all(cm, 0, n_prefill)) {
+            readers_ok = false;
+          }
+        }
+      });
+  }
+  vector<thread> writers;
+  for (unsigned w = 0; w < n_writers; w++) {
+    writers.emplace_back([&, w] {
+        initialize_thread();
+        for (uint64_t k = n_prefill + w; k < n; k += n_writers) {
+          cm->put(k, val(k));
+        }
+      });
+  }
+  for (thread &t : writers) {
+    t.join();
+  }
+  writing = false;
+  for (thread &t : threads) {
+    t.join();
+  }
+  background_migrator::stop();
+  check(!background_migrator::running(), "background migrator stopped");
+  check(readers_ok, "readers see untouched keys throughout growth");
+  check(holds_all(cm, 0, n), "concurrent puts all there");
+
+  for (uint64_t k = 0; k < n; k += 2) {
+    cm->remove(k);
+  }
+  bool odd_only = true;
+  for (uint64_t k = 0; k < n; k++) {
+    odd_only = odd_only && cm->contains(k) == (k % 2 == 1);
+  }
+  check(odd_only, "removes after growth");
+
+  uint64_t count = 0, sum = 0;
+  cm->for_each([&](uint64_t k, uint64_t v) {
+      count++;
+      sum += k;
+      odd_only = odd_only && v == val(k);
+    });
+  check(count == n / 2 && sum == n * n / 4 && odd_only, "for_each sees each key once");
+
+  atomic<uint64_t> pcount{0}, psum{0};
+  cm->for_each_parallel([&](uint64_t k, uint64_t) {
+      pcount++;
+      psum += k;
+    }, 4);
+  check(pcount == n / 2 && psum == n * n / 4, "for_each_parallel sees each key once");
+}
@@ -0,0 +1,170 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "mpgc/gc.h"
+#include "mpgc/external_gc_ptr.h"
+
+using namespace mpgc;
+using namespace std;
+
+namespace {
+  using namespace mpgc::inbound_pointers;
+
+  class cell : public gc_allocated {
+  public:
+    const uint64_t payload;
+
+    cell(gc_token &gc, uint64_t p) : gc_allocated{gc}, payload{p} {}
+
+    static const auto &descriptor() {
+      static gc_descriptor d =
+        GC_DESC(cell)
+        .WITH_FIELD(&cell::payload);
+      return d;
+    }
+  };
+
+  //Enough to grow the global cache several times over.
+  constexpr size_t n_threads = 8;
+  constexpr size_t per_thread = 8000;
+
+  void check(bool cond, const char *what) {
+    cout << (cond ? "ok:     " : "FAILED: ") << what << endl;
+    if (!cond) {
+      exit(1);
+    }
+  }
+
+  template <typename Fn>
+  void on_threads(Fn &&fn) {
+    vector<thread> threads;
+    for (size_t t = 0; t < n_threads; t++) {
+      threads.emplace_back([&fn, t]{ fn(t); });
+    }
+    for (thread &th : threads) {
+      th.join();
+    }
+  }
+
+  uint32_t refs(index_type i) {
+    return inbound_table::table()[i].refs.load();
+  }
+
+  bool cached(target_base *p) {
+    return global_cache::instance().find(p, [](index_type) { return true; }) != 0;
+  }
+
+  //Allocates garbage until the GC has finished two more cycles.
+  bool wait_for_cycles() {
+    const size_t target = memory_stats().cycle_number() + 2;
+    const auto deadline = chrono::steady_clock::now() + chrono::seconds(120);
+    while (memory_stats().cycle_number() < target) {
+      if (chrono::steady_clock::now() > deadline) {
+        return false;
+      }
+      for (int i = 0; i < 1000; i++) {
+        make_gc<cell>(i);
+      }
+    }
+    return true;
+  }
+}
+
+int main() {
+  initialize();
+  ic_control &ic = ic_control::block();
+
+  gc_ptr<cell> c = make_gc<cell>(42);
+  const index_type i = ic.lookup(c);
+  check(i != 0 && refs(i) == 1, "lookup takes a reference");
+  check(ic.lookup(c) == i && refs(i) == 2, "second lookup shares the slot");
+  check(cached(c.as_bare_pointer()), "slot is in the global cache");
+  ic_control::drop_ref(i);
+  ic_control::drop_ref(i);
+  check(refs(i) == inbound_table::slot::dead, "last reference kills the slot");
+  check(!cached(c.as_bare_pointer()), "dead slot leaves the global cache");
+
+  {
+    external_gc_ptr<cell> e1 = c;
+    external_gc_ptr<cell> e2 = e1;
+    external_gc_ptr<cell> e3 = c;
+    check(e1 == e2 && e3 == c && e3->payload == 42, "handles agree");
+  }
+
+  //Every thread makes handles to its own objects, concurrently, so the
+  //global cache is replaced while others are using it.
+  vector<vector<gc_ptr<cell>>> objects(n_threads);
+  vector<vector<index_type>> slots(n_threads);
+  on_threads([&](size_t t) {
+      ic_control &mine = ic_control::block();
+      for (size_t k = 0; k < per_thread; k++) {
+        objects[t].push_back(make_gc<cell>(t * per_thread + k));
+        slots[t].push_back(mine.lookup(objects[t].back()));
+      }
+    });
+
+  //New threads have nothing in their local caches, so they can only share
+  //through the global one.  It's a hint, and entries can be evicted or
+  //lost while it grows, so most, not all, should be found.
+  vector<size_t> shared(n_threads, 0);
+  on_threads([&](size_t t) {
+      ic_control &mine = ic_control::block();
+      const size_t other = (t + 1) % n_threads;
+      for (size_t k = 0; k < per_thread; k++) {
+        const index_type s = mine.lookup(objects[other][k]);
+        if (s == slots[other][k]) {
+          shared[t]++;
+        }
+        ic_control::drop_ref(s);
+      }
+    });
+  size_t n_shared = 0;
+  for (size_t n : shared) {
+    n_shared += n;
+  }
+  check(n_shared >= n_threads * per_thread * 9 / 10, "threads share slots through a grown cache");
+
+  //Only the handles keep the objects alive now.
+  vector<external_gc_ptr<cell>> handles;
+  for (size_t t = 0; t < n_threads; t++) {
+    for (size_t k = 0; k < per_thread; k++) {
+      handles.emplace_back(objects[t][k]);
+      ic_control::drop_ref(slots[t][k]);
+    }
+    objects[t].clear();
+  }
+  c = nullptr;
+  check(wait_for_cycles(), "GC cycles finish");
+  bool intact = true;
+  for (size_t j = 0; j < handles.size(); j++) {
+    intact = intact && handles[j]->payload == j;
+  }
+  check(intact, "objects held by handles survive collection");
+}
@@ -0,0 +1,84 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <cstdlib>
+#include "mpgc/gc.h"
+#include "mpgc/gc_inline_map.h"
+
+using namespace mpgc;
+using namespace std;
+
+namespace {
+  //Four segments, so they fill up quickly.
+  using map_type = gc_inline_map<uint64_t, uint32_t, ruts::hash1<uint64_t>, 2>;
+
+  constexpr size_t window = 200;
+  constexpr size_t n_churn = 20000;
+
+  void check(bool cond, const char *what) {
+    cout << (cond ? "ok:     " : "FAILED: ") << what << endl;
+    if (!cond) {
+      exit(1);
+    }
+  }
+}
+
+int main() {
+  initialize();
+  gc_ptr<map_type> m = make_gc<map_type>(window);
+  const size_t initial_slots = m->slot_count();
+
+  for (uint64_t k = 0; k < window; k++) {
+    m->put(k, uint32_t(k));
+  }
+  //Keys come and go, but there are never more than window of them, so
+  //the tombstones they leave behind shouldn't make the segments grow
+  //(past the one doubling the window itself may need).
+  size_t max_slots = 0;
+  bool consistent = true;
+  for (uint64_t k = window; k < window + n_churn; k++) {
+    m->put(k, uint32_t(k));
+    consistent = consistent && m->remove(k - window);
+    max_slots = max(max_slots, m->slot_count());
+  }
+  check(consistent, "every key removed once");
+  check(max_slots <= 2 * initial_slots, "segments stay bounded under churn");
+
+  bool present = true;
+  for (uint64_t k = n_churn; k < window + n_churn; k++) {
+    present = present && m->get(k) == uint32_t(k);
+  }
+  check(present, "window of keys still there");
+  check(!m->contains(0) && !m->contains(n_churn - 1), "removed keys gone");
+  check(m->put_new(5, 5).replaced && m->get(5) == 5, "removed key can come back");
+
+  //Live keys still double the segments.
+  const size_t before = m->slot_count();
+  for (uint64_t k = 0; k < 8 * before; k++) {
+    m->put(window + n_churn + k, 1);
+  }
+  check(m->slot_count() >= 8 * before, "segments grow with live keys");
+}
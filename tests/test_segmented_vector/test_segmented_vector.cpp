@@ -0,0 +1,123 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <cstdlib>
+#include <numeric>
+#include <stdexcept>
+#include "mpgc/gc.h"
+#include "mpgc/gc_segmented_vector.h"
+
+using namespace mpgc;
+using namespace std;
+
+namespace {
+  //Sixteen-element chunks, so a few hundred elements cross plenty of them.
+  using vec_type = external_gc_segmented_vector<uint64_t, 4>;
+
+  constexpr size_t n = 1000;
+
+  void check(bool cond, const char *what) {
+    cout << (cond ? "ok:     " : "FAILED: ") << what << endl;
+    if (!cond) {
+      exit(1);
+    }
+  }
+
+  bool holds_iota(const vec_type &v, size_t count) {
+    if (v.size() != count) {
+      return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+      if (v[i] != i) {
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+int main() {
+  initialize();
+  vec_type v;
+  check(v.empty() && v.capacity() == 0, "starts empty");
+
+  v.push_back(0);
+  const uint64_t *first = &v[0];
+  for (uint64_t i = 1; i < n; i++) {
+    v.push_back(i);
+  }
+  check(holds_iota(v, n), "push_back across chunks");
+  check(&v[0] == first, "growing doesn't move elements");
+  check(v.capacity() % vec_type::chunk_size == 0 && v.capacity() - n < vec_type::chunk_size,
+        "capacity is whole chunks");
+  check(v.front() == 0 && v.back() == n - 1, "front and back");
+
+  check(accumulate(v.begin(), v.end(), uint64_t{0}) == n * (n - 1) / 2, "iteration");
+  check(*v.rbegin() == n - 1 && *(v.rend() - 1) == 0 && v.end() - v.begin() == ptrdiff_t(n),
+        "reverse iterators and distance");
+  check(*(v.cbegin() + vec_type::chunk_size) == vec_type::chunk_size, "iterator arithmetic across a chunk");
+
+  bool threw = false;
+  try {
+    v.at(n);
+  } catch (const out_of_range &) {
+    threw = true;
+  }
+  check(threw, "at() past the end throws");
+
+  v.pop_back();
+  check(holds_iota(v, n - 1), "pop_back");
+  v.resize(10);
+  check(holds_iota(v, 10), "shrinking keeps the front");
+  v.resize(40);
+  bool cleared = true;
+  for (size_t i = 10; i < 40; i++) {
+    cleared = cleared && v[i] == 0;
+  }
+  check(cleared, "regrown elements are cleared");
+  v.resize(50, 7);
+  check(v[39] == 0 && v[40] == 7 && v[49] == 7, "resize with a value fills only the new ones");
+
+  v.emplace_back(99);
+  check(v.size() == 51 && v.back() == 99, "emplace_back");
+
+  vec_type w(20, 3);
+  v.swap(w);
+  check(v.size() == 20 && v[19] == 3 && w.size() == 51 && w.back() == 99, "swap");
+
+  vec_type moved(std::move(w));
+  check(moved.size() == 51 && w.empty(), "move");
+
+  const size_t cap = v.capacity();
+  v.clear();
+  check(v.empty() && v.capacity() == cap, "clear keeps the chunks");
+  v.resize(cap);
+  cleared = true;
+  for (uint64_t x : v) {
+    cleared = cleared && x == 0;
+  }
+  check(cleared, "cleared elements stay default");
+}
@@ -0,0 +1,169 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the 
+ *  Application containing code generated by the Library and added to the 
+ *  Application during this compilation process under terms of your choice, 
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include "mpgc/gc.h"
+
+#include <getopt.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace mpgc;
+
+const unsigned long _DEFAULT_NUM_ALLOCS = 1e6;
+const unsigned int  _DEFAULT_NUM_THREADS = 1,
+                    _DEFAULT_LIVE_SLOTS = 4096;
+const size_t        _DEFAULT_MIN_SIZE = 16,
+                    _DEFAULT_MAX_SIZE = 1 << 16;
+
+void show_usage() {
+   cerr << "usage: ./allocbench [options]\n\n"
+        << "Measures allocation latency and free list fragmentation. Every thread keeps a\n"
+        << "fixed number of live objects and keeps replacing a random one with a new object\n"
+        << "whose size is drawn log-uniformly from [min, max].\n"
+        << "Build with -DMPGC_SIZE_CLASS_LOG_BITS=0 to compare against power-of-two lists,\n"
+        << "and set MPGC_MAX_SLAB_SIZE=4096 to compare against fixed size slabs.\n\n"
+        << "Options:\n"
+        << "-n, --num-allocs <n>\t Allocations per thread. Default: " << _DEFAULT_NUM_ALLOCS << ".\n"
+        << "-t, --num-threads <t>\t Number of allocating threads. Default: " << _DEFAULT_NUM_THREADS << ".\n"
+        << "-l, --live <l>\t\t Live objects per thread. Default: " << _DEFAULT_LIVE_SLOTS << ".\n"
+        << "-m, --min-size <m>\t Smallest object size in bytes. Default: " << _DEFAULT_MIN_SIZE << ".\n"
+        << "-M, --max-size <M>\t Largest object size in bytes. Default: " << _DEFAULT_MAX_SIZE << ".\n"
+        << "-h, --help\t\t Display this message.\n";
+}
+
+void allocThread(unsigned long n, unsigned int live, size_t min_size, size_t max_size,
+                 vector<chrono::nanoseconds::rep> &latencies,
+                 gc_allocator::thread_alloc_state &alloc_state) {
+  initialize_thread();
+  mt19937_64 generator{random_device{}()};
+  uniform_real_distribution<double> log_size(log2(min_size), log2(max_size));
+  uniform_int_distribution<unsigned int> slot(0, live - 1);
+
+  gc_array_ptr<gc_array_ptr<char>> objects = make_gc_array<gc_array_ptr<char>>(live);
+  latencies.reserve(n);
+  for (unsigned long i = 0; i < n; i++) {
+    const size_t size = exp2(log_size(generator));
+    auto start = chrono::steady_clock::now();
+    gc_array_ptr<char> p = make_gc_array<char>(size);
+    auto end = chrono::steady_clock::now();
+    latencies.push_back(chrono::duration_cast<chrono::nanoseconds>(end - start).count());
+    objects[slot(generator)] = p;
+  }
+  alloc_state = gc_allocator::current_thread_alloc_state();
+}
+
+int main(int argc, char **argv) {
+  struct option long_options[] = {
+    {"num-allocs",  required_argument, 0, 'n'},
+    {"num-threads", required_argument, 0, 't'},
+    {"live",        required_argument, 0, 'l'},
+    {"min-size",    required_argument, 0, 'm'},
+    {"max-size",    required_argument, 0, 'M'},
+    {"help",        no_argument,       0, 'h'},
+    {0,             0,                 0,  0 }
+  };
+
+  unsigned long n      = _DEFAULT_NUM_ALLOCS;
+  unsigned int threads = _DEFAULT_NUM_THREADS,
+               live    = _DEFAULT_LIVE_SLOTS;
+  size_t min_size      = _DEFAULT_MIN_SIZE,
+         max_size      = _DEFAULT_MAX_SIZE;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "n:t:l:m:M:h", long_options, nullptr)) != -1) {
+    switch (opt) {
+      case 'n': n = atol(optarg);
+                break;
+      case 't': threads = atoi(optarg);
+                break;
+      case 'l': live = atoi(optarg);
+                break;
+      case 'm': min_size = atol(optarg);
+                break;
+      case 'M': max_size = atol(optarg);
+                break;
+      case 'h': show_usage();
+                return 0;
+      default:  show_usage();
+                return -1;
+    }
+  }
+  if (n == 0 || threads == 0 || live == 0 || min_size == 0 || min_size > max_size) {
+    show_usage();
+    return -1;
+  }
+
+  initialize_thread();
+  vector<vector<chrono::nanoseconds::rep>> latencies(threads);
+  vector<gc_allocator::thread_alloc_state> alloc_states(threads);
+  vector<thread> workers;
+  auto start = chrono::steady_clock::now();
+  for (unsigned int i = 0; i < threads; i++) {
+    workers.emplace_back(allocThread, n, live, min_size, max_size, ref(latencies[i]), ref(alloc_states[i]));
+  }
+  for (auto &t : workers) {
+    t.join();
+  }
+  auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+
+  vector<chrono::nanoseconds::rep> all;
+  for (auto &l : latencies) {
+    all.insert(all.end(), l.begin(), l.end());
+  }
+  sort(all.begin(), all.end());
+  auto percentile = [&all](double p) { return all[min(all.size() - 1, size_t(p * all.size()))]; };
+
+  size_t trips = 0, max_trips = 0;
+  for (auto &s : alloc_states) {
+    trips += s.global_trips;
+    max_trips = max(max_trips, s.global_trips);
+  }
+
+  gc_allocator::free_list_stats fl = gc_allocator::current_free_list_stats();
+  cout << "size classes per power of two: " << (1 << MPGC_SIZE_CLASS_LOG_BITS) << endl
+       << "allocations:     " << all.size() << endl
+       << "elapsed (ms):    " << elapsed.count() << endl
+       << "latency p50 (ns):   " << percentile(0.5) << endl
+       << "latency p99 (ns):   " << percentile(0.99) << endl
+       << "latency p99.9 (ns): " << percentile(0.999) << endl
+       << "latency max (ns):   " << all.back() << endl
+       << "max slab size:   " << gc_allocator::max_slab_size() << endl
+       << "global trips:    " << trips << endl
+       << "global trips/thread (max): " << max_trips << endl
+       << "allocs per global trip:    " << (trips == 0 ? 0.0 : double(all.size()) / trips) << endl
+       << "free chunks:     " << fl.n_chunks << endl
+       << "free bytes:      " << fl.bytes << endl
+       << "largest chunk:   " << fl.largest << endl
+       << "fragmentation:   " << (fl.bytes == 0 ? 0.0 : 1.0 - double(fl.largest) / fl.bytes) << endl;
+  return 0;
+}
@@ -0,0 +1,301 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include "workloads.h"
+
+#include <getopt.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace mpgc;
+
+const unsigned int _DEFAULT_NUM_THREADS = 1,
+                   _DEFAULT_NUM_PROCESSES = 1;
+const double       _DEFAULT_DURATION = 10;
+const size_t       _DEFAULT_LIVE_BYTES = 64 << 20;
+
+void show_usage() {
+   cerr << "usage: ./bench [options]\n\n"
+        << "Runs synthetic workloads against the heap and prints one JSON object per\n"
+        << "workload on stdout. Latencies are per operation, in nanoseconds. The GC\n"
+        << "figures are for all the processes using the heap during the run, and the\n"
+        << "bandwidths are per GC thread.\n\n"
+        << "Workloads:\n";
+   for (const workload &w : workloads()) {
+     cerr << "  " << w.name << "\t " << w.description << "\n";
+   }
+   cerr << "  all\t run all of the above, one after the other\n\n"
+        << "Options:\n"
+        << "-w, --workload <w>\t The workload to run. Default: all.\n"
+        << "-l, --live <bytes>\t Live set per process, e.g. 512M. Default: " << (_DEFAULT_LIVE_BYTES >> 20) << "M.\n"
+        << "-r, --rate <bytes>\t Allocation rate limit per process per second, e.g. 100M. Default: none.\n"
+        << "-t, --threads <t>\t Mutator threads per process. Default: " << _DEFAULT_NUM_THREADS << ".\n"
+        << "-p, --processes <p>\t Number of processes. Default: " << _DEFAULT_NUM_PROCESSES << ".\n"
+        << "-d, --duration <s>\t Seconds to run each workload. Default: " << _DEFAULT_DURATION << ".\n"
+        << "-h, --help\t\t Display this message.\n";
+}
+
+size_t parse_size(const string &s) {
+  static regex r("([0-9]+(?:\\.[0-9]*)?) *([KMGT]B?)?", regex::icase);
+  smatch m;
+  if (!regex_match(s.begin(), s.end(), m, r)) {
+    cerr << "Can't parse size: '" << s << "'" << endl;
+    exit(-1);
+  }
+  double n = stod(m[1]);
+  if (m[2].matched) {
+    switch (toupper(m[2].str()[0])) {
+    case 'T': n *= 1024;
+    case 'G': n *= 1024;
+    case 'M': n *= 1024;
+    case 'K': n *= 1024;
+    }
+  }
+  return size_t(n);
+}
+
+//What a process sends back. Only the first process fills in gc.
+struct process_result {
+  uint64_t ops = 0;
+  uint64_t bytes = 0;
+  uint64_t objects = 0;
+  double elapsed = 0;
+  bool has_gc = false;
+  gc_snapshot gc;
+  uint64_t heap_bytes = 0;
+  uint64_t in_use_bytes = 0;
+  latency_hist latency;
+
+  void merge(const process_result &other) {
+    ops += other.ops;
+    bytes += other.bytes;
+    objects += other.objects;
+    elapsed = max(elapsed, other.elapsed);
+    if (other.has_gc) {
+      has_gc = true;
+      gc = other.gc;
+      heap_bytes = other.heap_bytes;
+      in_use_bytes = other.in_use_bytes;
+    }
+    latency.merge(other.latency);
+  }
+};
+
+void run_process(const workload &w, size_t live, double rate, unsigned threads, double duration,
+                 bool report_gc, process_result &result) {
+  initialize_thread();
+  const gc_snapshot before = gc_snapshot::take();
+  vector<thread_ctx> ctxs(threads);
+  const auto start = chrono::steady_clock::now();
+  const auto deadline = start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(duration));
+  random_device seed;
+  for (thread_ctx &c : ctxs) {
+    c.live_bytes = live / threads;
+    c.bytes_per_sec = rate / threads;
+    c.deadline = deadline;
+    c.rng.seed(seed());
+  }
+  vector<thread> workers;
+  for (thread_ctx &c : ctxs) {
+    workers.emplace_back([&w, &c] {
+        initialize_thread();
+        w.run(c);
+      });
+  }
+  for (thread &t : workers) {
+    t.join();
+  }
+  result.elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  for (const thread_ctx &c : ctxs) {
+    result.ops += c.ops;
+    result.bytes += c.bytes;
+    result.objects += c.objects;
+    result.latency.merge(c.latency);
+  }
+  if (report_gc) {
+    result.has_gc = true;
+    result.gc = gc_snapshot::take() - before;
+    result.heap_bytes = memory_stats().bytes_in_heap();
+    result.in_use_bytes = memory_stats().bytes_in_use();
+  }
+}
+
+//Each process writes its result to its own pipe (the result is bigger than
+//PIPE_BUF, so writes to a shared one could interleave) and exits.
+process_result run_processes(const workload &w, size_t live, double rate, unsigned threads,
+                             unsigned processes, double duration) {
+  vector<int> from_child;
+  vector<pid_t> children;
+  for (unsigned i = 0; i < processes; i++) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      perror("pipe");
+      exit(-1);
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(fds[0]);
+      process_result r;
+      run_process(w, live, rate, threads, duration, i == 0, r);
+      const char *p = reinterpret_cast<const char*>(&r);
+      for (size_t left = sizeof(r); left > 0; ) {
+        ssize_t n = write(fds[1], p, left);
+        if (n <= 0) {
+          _exit(1);
+        }
+        p += n;
+        left -= n;
+      }
+      close(fds[1]);
+      //Exit normally, so that the GC thread is shut down cleanly.
+      exit(0);
+    } else if (pid < 0) {
+      perror("fork");
+      exit(-1);
+    }
+    close(fds[1]);
+    from_child.push_back(fds[0]);
+    children.push_back(pid);
+  }
+  process_result total;
+  for (int fd : from_child) {
+    process_result r;
+    char *p = reinterpret_cast<char*>(&r);
+    for (size_t left = sizeof(r); left > 0; ) {
+      ssize_t n = read(fd, p, left);
+      if (n <= 0) {
+        cerr << "A benchmark process died" << endl;
+        exit(-1);
+      }
+      p += n;
+      left -= n;
+    }
+    close(fd);
+    total.merge(r);
+  }
+  for (pid_t pid : children) {
+    waitpid(pid, nullptr, 0);
+  }
+  return total;
+}
+
+void report(const workload &w, size_t live, double rate, unsigned threads, unsigned processes,
+            const process_result &r) {
+  const gc_snapshot &g = r.gc;
+  auto per_sec = [](double n, double s) { return s == 0 ? 0.0 : n / s; };
+  cout << "{\"workload\": \"" << w.name << "\""
+       << ", \"processes\": " << processes
+       << ", \"threads\": " << threads
+       << ", \"live_bytes\": " << live
+       << ", \"rate_limit\": " << size_t(rate)
+       << ", \"elapsed_s\": " << r.elapsed
+       << ", \"ops\": " << r.ops
+       << ", \"alloc_bytes_per_s\": " << per_sec(r.bytes, r.elapsed)
+       << ", \"alloc_objects_per_s\": " << per_sec(r.objects, r.elapsed)
+       << ", \"latency_ns\": {\"p50\": " << r.latency.value_at(0.5)
+       << ", \"p90\": " << r.latency.value_at(0.9)
+       << ", \"p99\": " << r.latency.value_at(0.99)
+       << ", \"p999\": " << r.latency.value_at(0.999)
+       << ", \"max\": " << r.latency.max << "}"
+       << ", \"gc\": {\"cycles\": " << g.cycles
+       << ", \"cycle_ns_mean\": " << (g.cycle_samples == 0 ? 0 : g.cycle_ns / g.cycle_samples)
+       << ", \"mark_bytes_per_s\": " << per_sec(g.bytes_marked, g.marking_ns / 1e9)
+       << ", \"sweep_bytes_per_s\": " << per_sec(double(r.heap_bytes) * g.cycle_samples, g.sweep_ns / 1e9)
+       << ", \"handshake_ns_mean\": " << (g.handshakes == 0 ? 0 : g.handshake_ns / g.handshakes)
+       << ", \"allocation_stalls\": " << g.stalls
+       << ", \"allocation_stall_ns_mean\": " << (g.stalls == 0 ? 0 : g.stall_ns / g.stalls)
+       << ", \"heap_bytes\": " << r.heap_bytes
+       << ", \"in_use_bytes\": " << r.in_use_bytes << "}}" << endl;
+}
+
+int main(int argc, char **argv) {
+  struct option long_options[] = {
+    {"workload",  required_argument, 0, 'w'},
+    {"live",      required_argument, 0, 'l'},
+    {"rate",      required_argument, 0, 'r'},
+    {"threads",   required_argument, 0, 't'},
+    {"processes", required_argument, 0, 'p'},
+    {"duration",  required_argument, 0, 'd'},
+    {"help",      no_argument,       0, 'h'},
+    {0,           0,                 0,  0 }
+  };
+
+  string which = "all";
+  size_t live        = _DEFAULT_LIVE_BYTES;
+  double rate        = 0,
+         duration    = _DEFAULT_DURATION;
+  unsigned threads   = _DEFAULT_NUM_THREADS,
+           processes = _DEFAULT_NUM_PROCESSES;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "w:l:r:t:p:d:h", long_options, nullptr)) != -1) {
+    switch (opt) {
+      case 'w': which = optarg;
+                break;
+      case 'l': live = parse_size(optarg);
+                break;
+      case 'r': rate = parse_size(optarg);
+                break;
+      case 't': threads = atoi(optarg);
+                break;
+      case 'p': processes = atoi(optarg);
+                break;
+      case 'd': duration = atof(optarg);
+                break;
+      case 'h': show_usage();
+                return 0;
+      default:  show_usage();
+                return -1;
+    }
+  }
+  if (threads == 0 || processes == 0 || duration <= 0) {
+    show_usage();
+    return -1;
+  }
+
+  bool found = false;
+  for (const workload &w : workloads()) {
+    if (which == "all" || which == w.name) {
+      found = true;
+      //Every workload runs in fresh processes, so that one's live set doesn't
+      //linger into the next.
+      report(w, live, rate, threads, processes,
+             run_processes(w, live, rate, threads, processes, duration));
+    }
+  }
+  if (!found) {
+    show_usage();
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,434 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#ifndef TOOLS_COMMON_WORKLOADS_H_
+#define TOOLS_COMMON_WORKLOADS_H_
+
+#include "mpgc/gc.h"
+#include "mpgc/gc_telemetry.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <vector>
+
+/*
+ * A latency histogram with the same buckets as mpgc::log_histogram, but
+ * plain, so that it can be sent over a pipe and merged.
+ */
+struct latency_hist {
+  std::uint64_t counts[mpgc::log_histogram::n_buckets] = {};
+  std::uint64_t total = 0;
+  std::uint64_t max = 0;
+
+  void record(std::uint64_t v) {
+    counts[mpgc::log_histogram::bucket_for(v)]++;
+    total++;
+    max = v > max ? v : max;
+  }
+
+  void merge(const latency_hist &other) {
+    for (unsigned b = 0; b < mpgc::log_histogram::n_buckets; b++) {
+      counts[b] += other.counts[b];
+    }
+    total += other.total;
+    max = other.max > max ? other.max : max;
+  }
+
+  std::uint64_t value_at(double p) const {
+    const std::uint64_t target = std::uint64_t(p * total);
+    std::uint64_t seen = 0;
+    for (unsigned b = 0; b < mpgc::log_histogram::n_buckets; b++) {
+      seen += counts[b];
+      if (seen > target) {
+        return mpgc::log_histogram::bucket_lower(b);
+      }
+    }
+    return max;
+  }
+};
+
+/*
+ * Counters that threads also bump after every operation when they're given
+ * some in the heap, so that a driver can read them, even for a process it
+ * has killed.
+ */
+struct shared_counters {
+  std::atomic<std::uint64_t> ops{0};
+  std::atomic<std::uint64_t> bytes{0};
+  std::atomic<std::uint64_t> objects{0};
+  mpgc::log_histogram latency;
+};
+
+//What one mutator thread does and measures.
+struct thread_ctx {
+  std::size_t live_bytes;
+  //0 means as fast as possible.
+  double bytes_per_sec;
+  std::chrono::steady_clock::time_point deadline;
+  std::mt19937_64 rng;
+  //Optional. Stops the thread early once set.
+  const std::atomic<bool> *stop = nullptr;
+  //Optional.
+  shared_counters *shared = nullptr;
+
+  std::uint64_t ops = 0;
+  std::uint64_t bytes = 0;
+  std::uint64_t objects = 0;
+  latency_hist latency;
+
+  void allocated(std::size_t b, std::size_t n = 1) {
+    bytes += b;
+    objects += n;
+  }
+};
+
+//What the GC did while a workload ran, from the telemetry in the heap.
+struct gc_snapshot {
+  std::uint64_t cycles;
+  std::uint64_t cycle_samples;
+  std::uint64_t cycle_ns;
+  std::uint64_t marking_ns;
+  std::uint64_t sweep_ns;
+  std::uint64_t bytes_marked;
+  std::uint64_t handshakes;
+  std::uint64_t handshake_ns;
+  std::uint64_t stalls;
+  std::uint64_t stall_ns;
+
+  static gc_snapshot take() {
+    mpgc::gc_telemetry &t = mpgc::telemetry();
+    gc_snapshot s;
+    s.cycles = mpgc::memory_stats().cycle_number();
+    s.cycle_samples = t.phase(mpgc::gc_phase::sweep2).count();
+    s.cycle_ns = 0;
+    for (const mpgc::log_histogram &h : t.phase_ns) {
+      s.cycle_ns += h.sum();
+    }
+    s.marking_ns = t.phase(mpgc::gc_phase::marking).sum();
+    s.sweep_ns = t.phase(mpgc::gc_phase::sweep1).sum() + t.phase(mpgc::gc_phase::sweep2).sum();
+    s.bytes_marked = t.bytes_marked.sum();
+    s.handshakes = t.handshake_ns.count();
+    s.handshake_ns = t.handshake_ns.sum();
+    s.stalls = t.allocation_stall_ns.count();
+    s.stall_ns = t.allocation_stall_ns.sum();
+    return s;
+  }
+
+  gc_snapshot operator -(const gc_snapshot &o) const {
+    gc_snapshot d;
+    d.cycles = cycles - o.cycles;
+    d.cycle_samples = cycle_samples - o.cycle_samples;
+    d.cycle_ns = cycle_ns - o.cycle_ns;
+    d.marking_ns = marking_ns - o.marking_ns;
+    d.sweep_ns = sweep_ns - o.sweep_ns;
+    d.bytes_marked = bytes_marked - o.bytes_marked;
+    d.handshakes = handshakes - o.handshakes;
+    d.handshake_ns = handshake_ns - o.handshake_ns;
+    d.stalls = stalls - o.stalls;
+    d.stall_ns = stall_ns - o.stall_ns;
+    return d;
+  }
+};
+
+using workload_fn = void (*)(thread_ctx &);
+
+struct workload {
+  const char *name;
+  const char *description;
+  workload_fn run;
+};
+
+namespace bench {
+  using namespace std;
+  using namespace mpgc;
+
+  class bench_node : public gc_allocated {
+  public:
+    gc_ptr<bench_node> left;
+    gc_ptr<bench_node> right;
+    uint64_t payload;
+
+    bench_node(gc_token &gc, uint64_t p = 0,
+               const gc_ptr<bench_node> &l = nullptr,
+               const gc_ptr<bench_node> &r = nullptr)
+      : gc_allocated{gc}, left{l}, right{r}, payload{p} {}
+
+    static const auto &descriptor() {
+      static gc_descriptor d =
+        GC_DESC(bench_node)
+        .WITH_FIELD(&bench_node::left)
+        .WITH_FIELD(&bench_node::right)
+        .WITH_FIELD(&bench_node::payload);
+      return d;
+    }
+  };
+
+  constexpr size_t node_bytes = sizeof(bench_node);
+
+  template <typename T>
+  constexpr size_t array_bytes(size_t n) {
+    return sizeof(gc_array<T>) + n * sizeof(T);
+  }
+
+  /*
+   * Runs op until the deadline, timing each call. op reports what it
+   * allocated through ctx.allocated(). If there's a rate limit, sleeps
+   * whenever the thread gets ahead of it.
+   */
+  template <typename Fn>
+  void run_loop(thread_ctx &ctx, Fn &&op) {
+    const auto start = chrono::steady_clock::now();
+    while (true) {
+      const auto t0 = chrono::steady_clock::now();
+      if (t0 >= ctx.deadline || (ctx.stop != nullptr && *ctx.stop)) {
+        break;
+      }
+      const uint64_t bytes = ctx.bytes, objects = ctx.objects;
+      op();
+      const uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count();
+      ctx.latency.record(ns);
+      ctx.ops++;
+      if (ctx.shared != nullptr) {
+        ctx.shared->ops.fetch_add(1, memory_order_relaxed);
+        ctx.shared->bytes.fetch_add(ctx.bytes - bytes, memory_order_relaxed);
+        ctx.shared->objects.fetch_add(ctx.objects - objects, memory_order_relaxed);
+        ctx.shared->latency.record(ns);
+      }
+      if (ctx.bytes_per_sec > 0) {
+        const auto due = start + chrono::duration_cast<chrono::steady_clock::duration>(
+          chrono::duration<double>(ctx.bytes / ctx.bytes_per_sec));
+        if (due > chrono::steady_clock::now()) {
+          this_thread::sleep_until(min(due, ctx.deadline));
+        }
+      }
+    }
+  }
+
+  inline gc_ptr<bench_node> make_tree(thread_ctx &ctx, unsigned depth) {
+    if (depth == 0) {
+      ctx.allocated(node_bytes);
+      return make_gc<bench_node>(0);
+    }
+    gc_ptr<bench_node> l = make_tree(ctx, depth - 1);
+    gc_ptr<bench_node> r = make_tree(ctx, depth - 1);
+    ctx.allocated(node_bytes);
+    return make_gc<bench_node>(depth, l, r);
+  }
+
+  /*
+   * A long-lived complete binary tree holding the live set. Every op builds
+   * a small tree and swaps it in for a random subtree of the same depth,
+   * so the old one becomes garbage.
+   */
+  inline void tree_workload(thread_ctx &ctx) {
+    constexpr unsigned small_depth = 6;
+    unsigned depth = small_depth + 1;
+    while ((size_t(2) << (depth + 1)) * node_bytes <= ctx.live_bytes) {
+      depth++;
+    }
+    gc_ptr<bench_node> root = make_tree(ctx, depth);
+    uniform_int_distribution<int> coin(0, 1);
+    run_loop(ctx, [&] {
+        gc_ptr<bench_node> small = make_tree(ctx, small_depth);
+        gc_ptr<bench_node> parent = root;
+        for (unsigned d = depth; d > small_depth + 1; d--) {
+          parent = coin(ctx.rng) ? parent->left : parent->right;
+        }
+        if (coin(ctx.rng)) {
+          parent->left = small;
+        } else {
+          parent->right = small;
+        }
+      });
+  }
+
+  /*
+   * A FIFO queue of nodes holding the live set. Every op appends a batch of
+   * nodes at the tail and drops as many from the head.
+   */
+  inline void list_workload(thread_ctx &ctx) {
+    constexpr size_t batch = 64;
+    const size_t n = max(batch, ctx.live_bytes / node_bytes);
+    gc_ptr<bench_node> head = make_gc<bench_node>(0);
+    gc_ptr<bench_node> tail = head;
+    ctx.allocated(node_bytes);
+    for (size_t i = 1; i < n; i++) {
+      tail->left = make_gc<bench_node>(i);
+      tail = tail->left;
+      ctx.allocated(node_bytes);
+    }
+    uint64_t next = n;
+    run_loop(ctx, [&] {
+        for (size_t i = 0; i < batch; i++) {
+          tail->left = make_gc<bench_node>(next++);
+          tail = tail->left;
+          head = head->left;
+        }
+        ctx.allocated(batch * node_bytes, batch);
+      });
+  }
+
+  /*
+   * A random graph of out-degree two. Every op replaces random vertices
+   * with new ones pointing at random vertices, and points a random edge at
+   * each new vertex. Replaced vertices stay alive for as long as an edge
+   * still points at them, so the live set is somewhat above the vertices
+   * themselves.
+   */
+  inline void graph_workload(thread_ctx &ctx) {
+    constexpr size_t batch = 64;
+    const size_t n = max(batch, ctx.live_bytes / (2 * node_bytes));
+    gc_array_ptr<gc_ptr<bench_node>> vertices = make_gc_array<gc_ptr<bench_node>>(n);
+    ctx.allocated(array_bytes<gc_ptr<bench_node>>(n));
+    for (size_t i = 0; i < n; i++) {
+      vertices[i] = make_gc<bench_node>(i);
+    }
+    ctx.allocated(n * node_bytes, n);
+    uniform_int_distribution<size_t> vertex(0, n - 1);
+    for (size_t i = 0; i < n; i++) {
+      vertices[i]->left = vertices[vertex(ctx.rng)];
+      vertices[i]->right = vertices[vertex(ctx.rng)];
+    }
+    run_loop(ctx, [&] {
+        for (size_t i = 0; i < batch; i++) {
+          gc_ptr<bench_node> v = make_gc<bench_node>(i, vertices[vertex(ctx.rng)], vertices[vertex(ctx.rng)]);
+          vertices[vertex(ctx.rng)] = v;
+          gc_ptr<bench_node> from = vertices[vertex(ctx.rng)];
+          if (i & 1) {
+            from->left = v;
+          } else {
+            from->right = v;
+          }
+        }
+        ctx.allocated(batch * node_bytes, batch);
+      });
+  }
+
+  /*
+   * Slots holding large arrays, 64KB to 1MB, which go through the large
+   * object path. Every op replaces a random slot, alternating between
+   * arrays of data and arrays of (null) references, which have to be
+   * scanned.
+   */
+  inline void array_workload(thread_ctx &ctx) {
+    constexpr size_t min_bytes = 64 * 1024, max_bytes = 1024 * 1024;
+    const size_t n = max(size_t(4), ctx.live_bytes / ((min_bytes + max_bytes) / 2));
+    gc_array_ptr<gc_ptr<gc_allocated>> slots = make_gc_array<gc_ptr<gc_allocated>>(n);
+    ctx.allocated(array_bytes<gc_ptr<gc_allocated>>(n));
+    uniform_int_distribution<size_t> slot(0, n - 1);
+    uniform_int_distribution<size_t> words(min_bytes / 8, max_bytes / 8);
+    bool refs = false;
+    auto make_one = [&] {
+      const size_t w = words(ctx.rng);
+      refs = !refs;
+      if (refs) {
+        ctx.allocated(array_bytes<gc_ptr<bench_node>>(w));
+        return static_cast<gc_ptr<gc_allocated>>(make_gc_array<gc_ptr<bench_node>>(w));
+      } else {
+        ctx.allocated(array_bytes<uint64_t>(w));
+        return static_cast<gc_ptr<gc_allocated>>(make_gc_array<uint64_t>(w));
+      }
+    };
+    for (size_t i = 0; i < n; i++) {
+      slots[i] = make_one();
+    }
+    run_loop(ctx, [&] {
+        slots[slot(ctx.rng)] = make_one();
+      });
+  }
+
+  /*
+   * Lots of short-lived small objects, 16 bytes to 1KB with sizes drawn
+   * log-uniformly, replacing random slots of the live set.
+   */
+  inline void churn_workload(thread_ctx &ctx) {
+    constexpr size_t batch = 64;
+    const size_t n = max(batch, ctx.live_bytes / 192);
+    gc_array_ptr<gc_array_ptr<char>> slots = make_gc_array<gc_array_ptr<char>>(n);
+    ctx.allocated(array_bytes<gc_array_ptr<char>>(n));
+    uniform_int_distribution<size_t> slot(0, n - 1);
+    uniform_real_distribution<double> log_size(4, 10);
+    auto make_one = [&] {
+      const size_t size = exp2(log_size(ctx.rng));
+      ctx.allocated(array_bytes<char>(size));
+      return make_gc_array<char>(size);
+    };
+    for (size_t i = 0; i < n; i++) {
+      slots[i] = make_one();
+    }
+    run_loop(ctx, [&] {
+        for (size_t i = 0; i < batch; i++) {
+          slots[slot(ctx.rng)] = make_one();
+        }
+      });
+  }
+
+  /*
+   * One put per op into a gc_cuckoo_map that starts small, so that the ops
+   * keep running into growing segments.  The tail latency is what segment
+   * migration costs the mutators.  Once the map holds the live set, it's
+   * dropped and a new one started.
+   */
+  inline void cuckoo_workload(thread_ctx &ctx) {
+    using map_type = gc_cuckoo_map<ruts::uniform_key, uint64_t>;
+    //Roughly an entry plus its share of the slots in both tables.
+    constexpr size_t entry_bytes = 64;
+    constexpr size_t initial_capacity = 1 << 12;
+    const size_t n = max(initial_capacity, ctx.live_bytes / entry_bytes);
+    gc_ptr<map_type> map = make_gc<map_type>(initial_capacity);
+    uint64_t next = ctx.rng(), in_map = 0;
+    run_loop(ctx, [&] {
+        if (in_map == n) {
+          map = make_gc<map_type>(initial_capacity);
+          in_map = 0;
+        }
+        map->put(ruts::uniform_key(ruts::uniform_key::computed, next), next);
+        next++;
+        in_map++;
+        ctx.allocated(entry_bytes);
+      });
+  }
+}
+
+//All the workloads, in the order "all" runs them.
+inline const std::vector<workload> &workloads() {
+  using namespace bench;
+  static const std::vector<workload> all = {
+    {"tree",  "complete binary tree, random subtrees replaced", tree_workload},
+    {"list",  "FIFO linked list", list_workload},
+    {"graph", "random graph of out-degree two, vertices replaced", graph_workload},
+    {"array", "large data and reference arrays", array_workload},
+    {"churn", "short-lived small objects of random sizes", churn_workload},
+    {"cuckoo", "puts into a growing gc_cuckoo_map", cuckoo_workload}
+  };
+  return all;
+}
+
+#endif /* TOOLS_COMMON_WORKLOADS_H_ */
@@ -24,14 +24,51 @@
  *
  */
 
-#include "mpgc/gc_desc.h"
+#include "mpgc/gc.h"
 
-#include <iostream>
+#include <cxxabi.h>
+#include <getopt.h>
 #include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
 
 using namespace mpgc;
 using namespace std;
 
+void show_usage() {
+   cerr << "usage: ./descprint [options] [descriptor ...]\n\n"
+        << "Decodes the given GC descriptors (in hex), read from stdin if there are none.\n\n"
+        << "Options:\n"
+        << "-n, --names\t Attach to the heap and print the type each descriptor was registered for.\n"
+        << "-c, --census[=N]\t Print the N (default 20) types with the most live bytes in the last census.\n"
+        << "-e, --every=N\t Take a census every N GC cycles from now on (0 turns it off).\n"
+        << "-h, --help\t Display this message.\n";
+}
+
+bool use_names = false;
+
+string demangle(const char *name) {
+  if (name == nullptr) {
+    return "?";
+  }
+  int status;
+  unique_ptr<char, void(*)(void*)> d(abi::__cxa_demangle(name, nullptr, nullptr, &status), free);
+  return status == 0 ? string(d.get()) : string(name);
+}
+
+//Keys of compact descriptors can be shared by types with the same layout.
+string type_name(uint64_t key) {
+  string name = demangle(census().name_of(key));
+  return census().is_shared(key) ? name + " (and other types)" : name;
+}
+
 void process(string s) {
   transform(s.begin(), s.end(), s.begin(), ::toupper);
   if (s.length() >=2 && s[0] == '0' && s[1] == 'X') {
@@ -40,6 +77,9 @@ void process(string s) {
   uint64_t n;
   istringstream(s) >> hex >> n;
   s = "0x"+s;
+  if (use_names) {
+    s += " (" + type_name(gc_descriptor::type_key_of(n)) + ")";
+  }
   gc_descriptor::trace_desc(n, s.data());
 }
 
@@ -48,12 +88,78 @@ void loop(Iter from, Iter to) {
   for_each(from, to, process);
 }
 
+void print_census(size_t top) {
+  heap_census &c = census();
+  if (!c.has_stable()) {
+    cout << "No census yet. Every " << c.census_every() << " cycles"
+         << (c.census_every() == 0 ? " (off)" : "") << endl;
+    return;
+  }
+  vector<tuple<uint64_t, uint64_t, uint64_t>> entries;
+  uint64_t total_bytes = 0, total_objects = 0;
+  c.stable().for_each([&](uint64_t key, uint64_t bytes, uint64_t objects) {
+      entries.emplace_back(bytes, objects, key);
+      total_bytes += bytes;
+      total_objects += objects;
+    });
+  sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) {
+      return get<0>(a) > get<0>(b);
+    });
+  cout << "Census of cycle " << c.stable_cycle() << ": "
+       << total_bytes << " bytes in " << total_objects << " objects of "
+       << entries.size() << " types" << endl;
+  cout << setw(16) << "bytes" << setw(12) << "objects" << setw(8) << "%" << "  "
+       << setw(18) << left << "descriptor" << right << "  type" << endl;
+  for (size_t i = 0; i < entries.size() && i < top; i++) {
+    uint64_t bytes, objects, key;
+    tie(bytes, objects, key) = entries[i];
+    ostringstream k;
+    k << "0x" << hex << key;
+    cout << setw(16) << bytes << setw(12) << objects
+         << setw(8) << fixed << setprecision(2) << (total_bytes == 0 ? 0.0 : 100.0 * bytes / total_bytes) << "  "
+         << setw(18) << left << (key == 0 ? string("-") : k.str()) << right << "  "
+         << (key == 0 ? string("(table full)") : type_name(key)) << endl;
+  }
+}
+
 int main(int argc, char **argv) {
-  if (argc > 1) {
-    loop(argv+1, argv+argc);
-  } else {
+  struct option long_options[] = {
+    {"names",  no_argument,       0, 'n'},
+    {"census", optional_argument, 0, 'c'},
+    {"every",  required_argument, 0, 'e'},
+    {"help",   no_argument,       0, 'h'},
+    {0,        0,                 0,  0 }
+  };
+
+  bool show_census = false, set_every = false;
+  size_t top = 20;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "nc::e:h", long_options, nullptr)) != -1) {
+    switch (opt) {
+      case 'n': use_names = true;
+                break;
+      case 'c': show_census = true;
+                if (optarg) {
+                  top = strtoul(optarg, nullptr, 0);
+                }
+                break;
+      case 'e': census().set_census_every(strtoul(optarg, nullptr, 0));
+                set_every = true;
+                break;
+      case 'h': show_usage();
+                return 0;
+      default:  show_usage();
+                return -1;
+    }
+  }
+
+  if (show_census) {
+    print_census(top);
+  } else if (optind < argc) {
+    loop(argv+optind, argv+argc);
+  } else if (!set_every) {
     loop(istream_iterator<string>(cin),
          istream_iterator<string>());
   }
 }
-  
@@ -168,9 +168,11 @@ populateUsers(const unsigned long numUsers, unsigned int mean, unsigned int feed
   cout << "Populating graph with users..." << flush;
   // Populate vector with randomly-named users
   UniformRNG namerng(names.size());
-  users.reserve(numUsers);
+  auto batch = make_gc_batch<User>(numUsers, [&](unsigned long) {
+    return make_tuple(feedLength, names[namerng.randElt()]);
+  });
   for (unsigned long i = 0; i < numUsers; i++) {
-    users[i] = make_gc<User>(feedLength, names[namerng.randElt()]);
+    users[i] = batch[i];
   }
   cout << "Done.\n" << flush;
 
@@ -0,0 +1,120 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include "mpgc/gc.h"
+
+#include <getopt.h>
+#include <iostream>
+#include <string>
+
+using namespace std;
+using namespace mpgc;
+
+void show_usage() {
+   cerr << "usage: ./gctelemetry [options]\n\n"
+        << "Dumps the GC telemetry kept in the heap as JSON. Durations are in nanoseconds.\n"
+        << "Every process's GC thread records its own samples, so with several processes\n"
+        << "there are that many samples per cycle.\n\n"
+        << "Options:\n"
+        << "-b, --buckets\t Include the non-empty histogram buckets as [lower bound, count] pairs.\n"
+        << "-r, --reset\t Reset all the histograms after dumping them.\n"
+        << "-h, --help\t Display this message.\n";
+}
+
+void dump(const string &name, const log_histogram &h, bool buckets, bool last) {
+  cout << "    \"" << name << "\": {"
+       << "\"count\": " << h.count()
+       << ", \"sum\": " << h.sum()
+       << ", \"max\": " << h.max()
+       << ", \"p50\": " << h.value_at(0.5)
+       << ", \"p90\": " << h.value_at(0.9)
+       << ", \"p99\": " << h.value_at(0.99)
+       << ", \"p999\": " << h.value_at(0.999);
+  if (buckets) {
+    cout << ", \"buckets\": [";
+    bool first = true;
+    for (unsigned b = 0; b < log_histogram::n_buckets; b++) {
+      if (h.count_in(b) != 0) {
+        cout << (first ? "" : ", ") << "[" << log_histogram::bucket_lower(b) << ", " << h.count_in(b) << "]";
+        first = false;
+      }
+    }
+    cout << "]";
+  }
+  cout << "}" << (last ? "" : ",") << "\n";
+}
+
+int main(int argc, char **argv) {
+  struct option long_options[] = {
+    {"buckets", no_argument, 0, 'b'},
+    {"reset",   no_argument, 0, 'r'},
+    {"help",    no_argument, 0, 'h'},
+    {0,         0,           0,  0 }
+  };
+
+  bool buckets = false, reset = false;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "brh", long_options, nullptr)) != -1) {
+    switch (opt) {
+      case 'b': buckets = true;
+                break;
+      case 'r': reset = true;
+                break;
+      case 'h': show_usage();
+                return 0;
+      default:  show_usage();
+                return -1;
+    }
+  }
+
+  gc_telemetry &t = telemetry();
+  const gc_mem_stats &ms = memory_stats();
+  cout << "{\n"
+       << "  \"cycle\": " << ms.cycle_number() << ",\n"
+       << "  \"processes\": " << ms.n_processes() << ",\n"
+       << "  \"heap_bytes\": " << ms.bytes_in_heap() << ",\n"
+       << "  \"bytes_in_use\": " << ms.bytes_in_use() << ",\n"
+       << "  \"objects\": " << ms.n_objects() << ",\n"
+       << "  \"steals\": " << t.steals.load() << ",\n"
+       << "  \"phases_ns\": {\n";
+  for (std::size_t p = 0; p < std::size_t(gc_phase::count); p++) {
+    dump(phase_name(gc_phase(p)), t.phase_ns[p], buckets, p + 1 == std::size_t(gc_phase::count));
+  }
+  cout << "  },\n"
+       << "  \"histograms\": {\n";
+  dump("handshake_ns", t.handshake_ns, buckets, false);
+  dump("allocation_stall_ns", t.allocation_stall_ns, buckets, false);
+  dump("bytes_marked", t.bytes_marked, buckets, false);
+  dump("bytes_swept_to_lists", t.bytes_swept_to_lists, buckets, true);
+  cout << "  }\n"
+       << "}" << endl;
+
+  if (reset) {
+    t.reset();
+  }
+  return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include "mpgc/gc.h"
+
+#include <getopt.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace mpgc;
+
+void show_usage() {
+   cerr << "usage: ./gctrace [options]\n\n"
+        << "Merges the GC event rings of all the processes attached to the heap and\n"
+        << "writes them to stdout in Chrome's trace event format, which can be loaded\n"
+        << "in chrome://tracing or Perfetto. Each ring only keeps the most recent\n"
+        << trace_ring::capacity << " events of its process.\n\n"
+        << "Options:\n"
+        << "-p, --pid\t Only include the events of the given process.\n"
+        << "-h, --help\t Display this message.\n";
+}
+
+struct event {
+  pid_t pid;
+  trace_record rec;
+};
+
+int main(int argc, char **argv) {
+  struct option long_options[] = {
+    {"pid",  required_argument, 0, 'p'},
+    {"help", no_argument,       0, 'h'},
+    {0,      0,                 0,  0 }
+  };
+
+  pid_t only = 0;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "p:h", long_options, nullptr)) != -1) {
+    switch (opt) {
+      case 'p': only = atoi(optarg);
+                break;
+      case 'h': show_usage();
+                return 0;
+      default:  show_usage();
+                return -1;
+    }
+  }
+
+  gc_mem_stats &ms = memory_stats();
+  gc_control_block &cb = control_block();
+  vector<event> events;
+  vector<pid_t> pids;
+  for (per_process_struct *p = cb.process_struct_list.head(); p; p = cb.process_struct_list.next(p)) {
+    const pid_t pid = p->get_liveness().pid;
+    if (only != 0 && pid != only) {
+      continue;
+    }
+    pids.push_back(pid);
+    p->trace().for_each([&](const trace_record &r) {
+        events.push_back(event{pid, r});
+      });
+  }
+  stable_sort(events.begin(), events.end(), [](const event &a, const event &b) {
+      return a.rec.ts_ns < b.rec.ts_ns;
+    });
+
+  cout << "{\"otherData\": {\"cycle\": " << ms.cycle_number() << "},\n"
+       << " \"traceEvents\": [\n";
+  bool first = true;
+  for (pid_t pid : pids) {
+    cout << (first ? "" : ",\n")
+         << "  {\"ph\": \"M\", \"name\": \"process_name\", \"pid\": " << pid
+         << ", \"args\": {\"name\": \"mpgc " << pid << "\"}}";
+    first = false;
+  }
+  cout << fixed << setprecision(3);
+  for (const event &e : events) {
+    const trace_record &r = e.rec;
+    cout << (first ? "" : ",\n")
+         << "  {\"pid\": " << e.pid << ", \"tid\": " << r.tid
+         << ", \"ts\": " << r.ts_ns / 1000.0 << ", ";
+    first = false;
+    switch (r.type) {
+      case trace_event::phase_enter:
+      case trace_event::phase_exit:
+        cout << "\"ph\": \"" << (r.type == trace_event::phase_enter ? "B" : "E")
+             << "\", \"cat\": \"phase\", \"name\": \"" << phase_name(gc_phase(r.sub)) << "\"}";
+        break;
+      case trace_event::barrier_inc:
+        cout << "\"ph\": \"i\", \"s\": \"t\", \"cat\": \"barrier\", \"name\": \"" << trace_event_name(r.type)
+             << "\", \"args\": {\"barrier\": " << unsigned(r.sub) << ", \"before\": " << r.arg << "}}";
+        break;
+      case trace_event::steal:
+      case trace_event::dead_process:
+        cout << "\"ph\": \"i\", \"s\": \"p\", \"cat\": \"process\", \"name\": \"" << trace_event_name(r.type)
+             << "\", \"args\": {\"pid\": " << r.arg << "}}";
+        break;
+      case trace_event::handshake_send:
+      case trace_event::handshake_ack:
+        cout << "\"ph\": \"i\", \"s\": \"t\", \"cat\": \"handshake\", \"name\": \"" << trace_event_name(r.type)
+             << "\", \"args\": {\"signal\": " << unsigned(r.sub);
+        if (r.type == trace_event::handshake_send) {
+          cout << ", \"threads\": " << r.arg;
+        }
+        cout << "}}";
+        break;
+      default:
+        cout << "\"ph\": \"i\", \"s\": \"t\", \"name\": \"" << trace_event_name(r.type) << "\"}";
+        break;
+    }
+  }
+  cout << "\n ]\n}" << endl;
+  return 0;
+}
@@ -0,0 +1,385 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include "mpgc/gc.h"
+
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <regex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+using namespace mpgc;
+
+const double   _DEFAULT_MIN_TIME = 0.2;
+const unsigned _DEFAULT_REPETITIONS = 3;
+
+void show_usage() {
+   cerr << "usage: ./microbench [options]\n\n"
+        << "Times GC primitives in a loop, in the manner of Google Benchmark. The\n"
+        << "write barrier and gc_ptr CAS are timed with the thread pinned to each GC\n"
+        << "state. While pinned, the GC is held up at its next handshake, and the\n"
+        << "states that mark gray are capped at " << (1 << 20) << " iterations, as every\n"
+        << "iteration adds to a mark buffer.\n\n"
+        << "Options:\n"
+        << "-f, --filter <regex>\t Only run the benchmarks whose names match.\n"
+        << "-t, --min-time <s>\t Minimum time per repetition. Default: " << _DEFAULT_MIN_TIME << ".\n"
+        << "-r, --repetitions <r>\t Repetitions; the median is reported. Default: " << _DEFAULT_REPETITIONS << ".\n"
+        << "-j, --json\t\t Print JSON rather than a table.\n"
+        << "-l, --list\t\t List the benchmarks and exit.\n"
+        << "-h, --help\t\t Display this message.\n";
+}
+
+//Keeps the compiler from optimizing away a value or a store.
+template <typename T>
+inline void do_not_optimize(const T &v) {
+  asm volatile("" : : "r,m"(v) : "memory");
+}
+
+inline void clobber_memory() {
+  asm volatile("" : : : "memory");
+}
+
+struct benchmark {
+  string name;
+  //Runs the operation the given number of times.
+  function<void(size_t)> run;
+  size_t max_iterations;
+};
+
+vector<benchmark> &benchmarks() {
+  static vector<benchmark> all;
+  return all;
+}
+
+void add_benchmark(const string &name, function<void(size_t)> run, size_t max_iterations = size_t(-1)) {
+  benchmarks().push_back(benchmark{name, run, max_iterations});
+}
+
+class bench_obj : public gc_allocated {
+public:
+  gc_ptr<bench_obj> ref;
+  atomic<gc_ptr<bench_obj>> aref;
+  uint64_t payload;
+
+  bench_obj(gc_token &gc) : gc_allocated{gc}, payload{0} {}
+
+  static const auto &descriptor() {
+    static gc_descriptor d =
+      GC_DESC(bench_obj)
+      .WITH_FIELD(&bench_obj::ref)
+      .WITH_FIELD(&bench_obj::aref)
+      .WITH_FIELD(&bench_obj::payload);
+    return d;
+  }
+};
+
+/*
+ * While alive, makes the write barriers on this thread behave as if the GC
+ * were in the given state. The thread's own status is left alone, as the GC
+ * thread waits on it in handshakes. Instead, the thread's handle points at a
+ * stand-in struct, and the handshake signal is blocked, so that a handshake
+ * just waits until the pin is released. Nothing may be allocated while pinned.
+ */
+class pinned_state {
+  sigset_t _old_mask;
+  gc_handshake::in_memory_thread_struct *_real;
+  unique_ptr<gc_handshake::in_memory_thread_struct> _stand_in;
+
+public:
+  explicit pinned_state(gc_handshake::Signum s) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGRTMIN);
+    pthread_sigmask(SIG_BLOCK, &set, &_old_mask);
+    _real = gc_handshake::thread_struct_handles.handle;
+    _stand_in.reset(new gc_handshake::in_memory_thread_struct());
+    _stand_in->status_idx = gc_status(s, _real->status_idx.load().index());
+    gc_handshake::thread_struct_handles.handle = _stand_in.get();
+  }
+
+  ~pinned_state() {
+    gc_handshake::thread_struct_handles.handle = _real;
+    _stand_in.reset();
+    pthread_sigmask(SIG_SETMASK, &_old_mask, nullptr);
+  }
+};
+
+struct gc_state {
+  const char *name;
+  gc_handshake::Signum sig;
+  bool marks_gray;
+};
+
+const gc_state gc_states[] = {
+  {"sync1", gc_handshake::Signum::sigSync1, true},
+  {"sync2", gc_handshake::Signum::sigSync2, true},
+  {"async", gc_handshake::Signum::sigAsync, true},
+  {"sweep", gc_handshake::Signum::sigSweep, false}
+};
+
+const size_t gray_max_iterations = 1 << 20;
+
+using bench_map = gc_cuckoo_map<ruts::uniform_key, uint64_t>;
+const size_t map_entries = 1 << 18;
+//Objects per make_gc_batch() call.
+const size_t alloc_batch = 256;
+//Lookups per find_batch() call.
+const size_t lookup_batch = 64;
+
+//objs and map must stay on main's stack, as that's what keeps the objects alive.
+void register_benchmarks(gc_array_ptr<gc_ptr<bench_obj>> &objs, gc_ptr<bench_map> &map) {
+  for (size_t i = 0; i < objs.size(); i++) {
+    objs[i] = make_gc<bench_obj>();
+  }
+
+  for (const gc_state &s : gc_states) {
+    add_benchmark(string("write_barrier/") + s.name, [s, &objs](size_t n) {
+        gc_ptr<bench_obj> holder = objs[0], a = objs[1], b = objs[2];
+        pinned_state pin(s.sig);
+        for (size_t i = 0; i < n; i++) {
+          holder->ref = (i & 1) ? a : b;
+          clobber_memory();
+        }
+      }, s.marks_gray ? gray_max_iterations : size_t(-1));
+
+    add_benchmark(string("gc_ptr_cas/") + s.name, [s, &objs](size_t n) {
+        gc_ptr<bench_obj> holder = objs[0], a = objs[1], b = objs[2];
+        holder->aref = a;
+        pinned_state pin(s.sig);
+        for (size_t i = 0; i < n; i++) {
+          gc_ptr<bench_obj> expected = (i & 1) ? b : a;
+          do_not_optimize(holder->aref.compare_exchange_strong(expected, (i & 1) ? a : b));
+        }
+      }, s.marks_gray ? gray_max_iterations : size_t(-1));
+  }
+
+  add_benchmark("gc_ptr_load", [&objs](size_t n) {
+      gc_ptr<bench_obj> holder = objs[0];
+      holder->aref = objs[1];
+      for (size_t i = 0; i < n; i++) {
+        do_not_optimize(holder->aref.load());
+      }
+    });
+
+  for (size_t size : {16, 64, 256, 1024, 4096, 16384, 65536, 262144}) {
+    add_benchmark("alloc/" + to_string(size), [size](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+          do_not_optimize(make_gc_array<char>(size));
+        }
+      });
+  }
+
+  add_benchmark("alloc/object", [](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        do_not_optimize(make_gc<bench_obj>());
+      }
+    });
+
+  //The same objects through make_gc_batch(), so the time is per object too.
+  add_benchmark("alloc/batch", [](size_t n) {
+      for (size_t i = 0; i < n; i += alloc_batch) {
+        do_not_optimize(make_gc_batch<bench_obj>(min(alloc_batch, n - i), [](size_t) {
+              return make_tuple();
+            }));
+      }
+    });
+
+  //The same keys in the same (random) order, looked up one at a time or in batches.
+  static vector<ruts::uniform_key> keys;
+  for (uint64_t k = 0; k < map_entries; k++) {
+    keys.emplace_back(ruts::uniform_key::computed, k);
+    map->put(keys.back(), k);
+  }
+  shuffle(keys.begin(), keys.end(), mt19937_64{});
+
+  add_benchmark("cuckoo_get/single", [&map](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        do_not_optimize(map->get(keys[i % map_entries]));
+      }
+    });
+
+  add_benchmark("cuckoo_get/batch", [&map](size_t n) {
+      uint64_t vals[lookup_batch];
+      for (size_t i = 0; i < n; i += lookup_batch) {
+        const size_t at = i % map_entries;
+        map->find_batch(&keys[at], min({lookup_batch, n - i, map_entries - at}), vals);
+        do_not_optimize(vals[0]);
+      }
+    });
+
+  //Pointers into the heap, so that the conversions can't be folded.
+  static vector<bench_obj*> bare;
+  static vector<offset_ptr<bench_obj>> offsets;
+  for (size_t i = 0; i < 1024; i++) {
+    bare.push_back(objs[i % objs.size()].as_bare_pointer());
+    offsets.push_back(offset_ptr<bench_obj>(bare.back()));
+  }
+
+  add_benchmark("offset_ptr/from_bare", [](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        do_not_optimize(offset_ptr<bench_obj>(bare[i & 1023]));
+      }
+    });
+
+  add_benchmark("offset_ptr/to_bare", [](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        do_not_optimize(offsets[i & 1023].as_bare_pointer());
+      }
+    });
+
+  add_benchmark("offset_ptr/deref", [](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        do_not_optimize(offsets[i & 1023]->payload);
+      }
+    });
+
+  add_benchmark("offset_ptr/is_valid", [](size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        do_not_optimize(offsets[i & 1023].is_valid());
+      }
+    });
+}
+
+double time_it(const benchmark &b, size_t n) {
+  auto start = chrono::steady_clock::now();
+  b.run(n);
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+//Like Google Benchmark, grows the iteration count until a run takes long enough.
+size_t calibrate(const benchmark &b, double min_time) {
+  size_t n = 1;
+  while (n < b.max_iterations) {
+    const double t = time_it(b, n);
+    if (t >= min_time) {
+      break;
+    }
+    const double scale = t < min_time / 100 ? 10 : 1.4 * min_time / t;
+    n = min(b.max_iterations, max(n + 1, size_t(n * scale)));
+  }
+  return n;
+}
+
+int main(int argc, char **argv) {
+  struct option long_options[] = {
+    {"filter",      required_argument, 0, 'f'},
+    {"min-time",    required_argument, 0, 't'},
+    {"repetitions", required_argument, 0, 'r'},
+    {"json",        no_argument,       0, 'j'},
+    {"list",        no_argument,       0, 'l'},
+    {"help",        no_argument,       0, 'h'},
+    {0,             0,                 0,  0 }
+  };
+
+  string filter = ".*";
+  double min_time = _DEFAULT_MIN_TIME;
+  unsigned repetitions = _DEFAULT_REPETITIONS;
+  bool json = false, list = false;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "f:t:r:jlh", long_options, nullptr)) != -1) {
+    switch (opt) {
+      case 'f': filter = optarg;
+                break;
+      case 't': min_time = atof(optarg);
+                break;
+      case 'r': repetitions = atoi(optarg);
+                break;
+      case 'j': json = true;
+                break;
+      case 'l': list = true;
+                break;
+      case 'h': show_usage();
+                return 0;
+      default:  show_usage();
+                return -1;
+    }
+  }
+  if (repetitions == 0 || min_time <= 0) {
+    show_usage();
+    return -1;
+  }
+
+  initialize_thread();
+  gc_array_ptr<gc_ptr<bench_obj>> objs = make_gc_array<gc_ptr<bench_obj>>(3);
+  gc_ptr<bench_map> map = make_gc<bench_map>(map_entries);
+  register_benchmarks(objs, map);
+  const regex re(filter);
+
+  if (list) {
+    for (const benchmark &b : benchmarks()) {
+      cout << b.name << endl;
+    }
+    return 0;
+  }
+
+  if (json) {
+    cout << "{\n  \"context\": {\"min_time\": " << min_time << ", \"repetitions\": " << repetitions << "},\n"
+         << "  \"benchmarks\": [";
+  } else {
+    cout << left << setw(28) << "Benchmark" << right << setw(14) << "Time (ns)" << setw(14) << "Iterations" << endl
+         << string(56, '-') << endl;
+  }
+  bool first = true;
+  for (const benchmark &b : benchmarks()) {
+    if (!regex_search(b.name, re)) {
+      continue;
+    }
+    const size_t n = calibrate(b, min_time);
+    vector<double> ns;
+    for (unsigned r = 0; r < repetitions; r++) {
+      ns.push_back(time_it(b, n) * 1e9 / n);
+    }
+    sort(ns.begin(), ns.end());
+    const double median = ns[ns.size() / 2];
+    if (json) {
+      cout << (first ? "\n" : ",\n")
+           << "    {\"name\": \"" << b.name << "\", \"iterations\": " << n
+           << ", \"real_time\": " << median << ", \"min_time\": " << ns.front()
+           << ", \"max_time\": " << ns.back() << ", \"time_unit\": \"ns\"}";
+    } else {
+      cout << left << setw(28) << b.name << right << setw(14) << fixed << setprecision(2) << median
+           << setw(14) << n << endl;
+    }
+    first = false;
+  }
+  if (json) {
+    cout << "\n  ]\n}" << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,339 @@
+/*
+ *
+ *  Multi Process Garbage Collector
+ *  Copyright © 2016 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include "workloads.h"
+
+#include <getopt.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace mpgc;
+
+const unsigned int _DEFAULT_NUM_THREADS = 1,
+                   _MAX_PROCESSES = 64;
+const double       _DEFAULT_DURATION = 10;
+const size_t       _DEFAULT_LIVE_BYTES = 64 << 20;
+static const string _DEFAULT_PROCESSES = "1,2,4";
+static const string _RUN_KEY = "com.hpe.mpgc.scalebench.run";
+
+void show_usage() {
+   cerr << "usage: ./scalebench [options]\n\n"
+        << "Measures how a workload scales with the number of processes sharing the heap.\n"
+        << "For every process count, forks that many worker processes, starts them together\n"
+        << "through a persistent root, and prints one JSON object with the throughput of\n"
+        << "every process, read from the heap, and what the GC did in the meantime.\n"
+        << "With -k, a random worker is killed with SIGKILL and restarted every <k> seconds,\n"
+        << "and the time the GC took to get through two cycles after each kill is reported.\n"
+        << "Workloads are the ones of ./bench.\n\n"
+        << "Options:\n"
+        << "-w, --workload <w>\t The workload to run. Default: graph.\n"
+        << "-p, --processes <list>\t Comma separated process counts to run, up to " << _MAX_PROCESSES
+        << ". Default: " << _DEFAULT_PROCESSES << ".\n"
+        << "-t, --threads <t>\t Mutator threads per process. Default: " << _DEFAULT_NUM_THREADS << ".\n"
+        << "-l, --live <bytes>\t Live set per process. Default: " << (_DEFAULT_LIVE_BYTES >> 20) << "M.\n"
+        << "-r, --rate <bytes>\t Allocation rate limit per process per second. Default: none.\n"
+        << "-d, --duration <s>\t Seconds to run each process count. Default: " << _DEFAULT_DURATION << ".\n"
+        << "-k, --kill <s>\t\t Kill and restart a worker every <s> seconds. Default: never.\n"
+        << "-h, --help\t\t Display this message.\n";
+}
+
+size_t parse_size(const string &s) {
+  char *end;
+  double n = strtod(s.c_str(), &end);
+  switch (toupper(*end)) {
+  case 'T': n *= 1024;
+  case 'G': n *= 1024;
+  case 'M': n *= 1024;
+  case 'K': n *= 1024;
+  }
+  return size_t(n);
+}
+
+struct worker_slot {
+  std::atomic<pid_t> pid{0};
+  std::atomic<unsigned> starts{0};
+  shared_counters counters;
+};
+
+//Lives in the heap under _RUN_KEY while a process count is being run. It's
+//too big for a descriptor of its own, so it's laid over an array of words.
+struct run_state {
+  std::atomic<unsigned> ready{0};
+  std::atomic<bool> go{false};
+  std::atomic<bool> stop{false};
+  worker_slot slots[_MAX_PROCESSES];
+};
+
+using run_ptr = gc_ptr<gc_array<uint64_t>>;
+
+run_state &state_of(const run_ptr &p) {
+  return *reinterpret_cast<run_state*>(&(*p)[0]);
+}
+
+struct worker_args {
+  string workload;
+  size_t live;
+  double rate;
+  unsigned threads;
+  double duration;
+};
+
+//The worker side. Restarted workers don't wait, as the others have already gone.
+int run_worker(unsigned slot, const worker_args &args) {
+  const workload *w = nullptr;
+  for (const workload &x : workloads()) {
+    if (args.workload == x.name) {
+      w = &x;
+    }
+  }
+  run_ptr run = persistent_roots().lookup<gc_array<uint64_t>>(_RUN_KEY);
+  if (w == nullptr || run == nullptr || slot >= _MAX_PROCESSES) {
+    return -1;
+  }
+  run_state &r = state_of(run);
+  worker_slot &s = r.slots[slot];
+  s.pid = getpid();
+  if (s.starts++ == 0) {
+    r.ready++;
+  }
+  while (!r.go) {
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+
+  const auto deadline = chrono::steady_clock::now()
+    + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(args.duration));
+  vector<thread_ctx> ctxs(args.threads);
+  random_device seed;
+  for (thread_ctx &c : ctxs) {
+    c.live_bytes = args.live / args.threads;
+    c.bytes_per_sec = args.rate / args.threads;
+    c.deadline = deadline;
+    c.rng.seed(seed());
+    c.stop = &r.stop;
+    c.shared = &s.counters;
+  }
+  vector<thread> workers;
+  for (thread_ctx &c : ctxs) {
+    workers.emplace_back([w, &c] {
+        initialize_thread();
+        w->run(c);
+      });
+  }
+  for (thread &t : workers) {
+    t.join();
+  }
+  return 0;
+}
+
+//fork() and exec() ourselves, so that the worker starts out with a clean GC state.
+pid_t spawn_worker(const vector<string> &argv) {
+  vector<char*> cargv;
+  for (const string &a : argv) {
+    cargv.push_back(const_cast<char*>(a.c_str()));
+  }
+  cargv.push_back(nullptr);
+  pid_t pid = fork();
+  if (pid == 0) {
+    execv("/proc/self/exe", cargv.data());
+    _exit(127);
+  } else if (pid < 0) {
+    perror("fork");
+    exit(-1);
+  }
+  return pid;
+}
+
+void run_count(unsigned n, const worker_args &args, double kill_every) {
+  run_ptr run = make_gc_array<uint64_t>((sizeof(run_state) + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+  run_state &r = *new (&(*run)[0]) run_state;
+  persistent_roots().store(_RUN_KEY, run);
+
+  auto worker_argv = [&](unsigned slot) {
+    ostringstream rate;
+    rate << args.rate;
+    return vector<string>{"scalebench", "--worker", to_string(slot),
+        "-w", args.workload, "-l", to_string(args.live), "-r", rate.str(),
+        "-t", to_string(args.threads), "-d", to_string(args.duration * 2 + 60)};
+  };
+
+  vector<pid_t> pids(n);
+  for (unsigned i = 0; i < n; i++) {
+    pids[i] = spawn_worker(worker_argv(i));
+  }
+  while (r.ready < n) {
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+
+  const gc_snapshot before = gc_snapshot::take();
+  const auto start = chrono::steady_clock::now();
+  const auto end = start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(args.duration));
+  r.go = true;
+
+  mt19937_64 rng{random_device{}()};
+  vector<double> recoveries;
+  if (kill_every > 0) {
+    const auto interval = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(kill_every));
+    for (auto next = start + interval; next < end; next += interval) {
+      this_thread::sleep_until(next);
+      const unsigned victim = uniform_int_distribution<unsigned>(0, n - 1)(rng);
+      const size_t cycle = memory_stats().cycle_number();
+      const auto killed = chrono::steady_clock::now();
+      kill(pids[victim], SIGKILL);
+      waitpid(pids[victim], nullptr, 0);
+      pids[victim] = spawn_worker(worker_argv(victim));
+      //The cycle in progress has to get past the dead process, and the next
+      //one has to do without it.
+      while (memory_stats().cycle_number() < cycle + 2 && chrono::steady_clock::now() < end) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+      }
+      if (memory_stats().cycle_number() >= cycle + 2) {
+        recoveries.push_back(chrono::duration<double>(chrono::steady_clock::now() - killed).count());
+      }
+    }
+  }
+  this_thread::sleep_until(end);
+  r.stop = true;
+  for (pid_t pid : pids) {
+    waitpid(pid, nullptr, 0);
+  }
+  const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  const gc_snapshot g = gc_snapshot::take() - before;
+  persistent_roots().remove(_RUN_KEY);
+
+  uint64_t ops = 0, bytes = 0;
+  cout << "{\"workload\": \"" << args.workload << "\""
+       << ", \"processes\": " << n
+       << ", \"threads\": " << args.threads
+       << ", \"elapsed_s\": " << elapsed
+       << ", \"per_process\": [";
+  for (unsigned i = 0; i < n; i++) {
+    const worker_slot &s = r.slots[i];
+    ops += s.counters.ops;
+    bytes += s.counters.bytes;
+    cout << (i == 0 ? "" : ", ")
+         << "{\"ops_per_s\": " << s.counters.ops / elapsed
+         << ", \"alloc_bytes_per_s\": " << s.counters.bytes / elapsed
+         << ", \"latency_p99_ns\": " << s.counters.latency.value_at(0.99)
+         << ", \"starts\": " << s.starts << "}";
+  }
+  cout << "]"
+       << ", \"ops_per_s\": " << ops / elapsed
+       << ", \"alloc_bytes_per_s\": " << bytes / elapsed
+       << ", \"gc\": {\"cycles\": " << g.cycles
+       << ", \"cycle_ns_mean\": " << (g.cycle_samples == 0 ? 0 : g.cycle_ns / g.cycle_samples)
+       << ", \"mark_bytes_per_s\": " << (g.marking_ns == 0 ? 0.0 : g.bytes_marked / (g.marking_ns / 1e9))
+       << ", \"handshake_ns_mean\": " << (g.handshakes == 0 ? 0 : g.handshake_ns / g.handshakes)
+       << ", \"in_use_bytes\": " << memory_stats().bytes_in_use() << "}";
+  if (kill_every > 0) {
+    double sum = 0, worst = 0;
+    for (double d : recoveries) {
+      sum += d;
+      worst = max(worst, d);
+    }
+    cout << ", \"kills\": {\"recovered\": " << recoveries.size()
+         << ", \"two_cycles_after_kill_s_mean\": " << (recoveries.empty() ? 0 : sum / recoveries.size())
+         << ", \"two_cycles_after_kill_s_max\": " << worst << "}";
+  }
+  cout << "}" << endl;
+}
+
+int main(int argc, char **argv) {
+  struct option long_options[] = {
+    {"workload",  required_argument, 0, 'w'},
+    {"processes", required_argument, 0, 'p'},
+    {"threads",   required_argument, 0, 't'},
+    {"live",      required_argument, 0, 'l'},
+    {"rate",      required_argument, 0, 'r'},
+    {"duration",  required_argument, 0, 'd'},
+    {"kill",      required_argument, 0, 'k'},
+    {"worker",    required_argument, 0, 'W'},
+    {"help",      no_argument,       0, 'h'},
+    {0,           0,                 0,  0 }
+  };
+
+  worker_args args{"graph", _DEFAULT_LIVE_BYTES, 0, _DEFAULT_NUM_THREADS, _DEFAULT_DURATION};
+  string counts = _DEFAULT_PROCESSES;
+  double kill_every = 0;
+  int worker = -1;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "w:p:t:l:r:d:k:W:h", long_options, nullptr)) != -1) {
+    switch (opt) {
+      case 'w': args.workload = optarg;
+                break;
+      case 'p': counts = optarg;
+                break;
+      case 't': args.threads = atoi(optarg);
+                break;
+      case 'l': args.live = parse_size(optarg);
+                break;
+      case 'r': args.rate = parse_size(optarg);
+                break;
+      case 'd': args.duration = atof(optarg);
+                break;
+      case 'k': kill_every = atof(optarg);
+                break;
+      case 'W': worker = atoi(optarg);
+                break;
+      case 'h': show_usage();
+                return 0;
+      default:  show_usage();
+                return -1;
+    }
+  }
+
+  if (worker >= 0) {
+    return run_worker(worker, args);
+  }
+
+  vector<unsigned> ns;
+  istringstream in(counts);
+  for (string c; getline(in, c, ','); ) {
+    ns.push_back(atoi(c.c_str()));
+  }
+  bool known = false;
+  for (const workload &w : workloads()) {
+    known = known || args.workload == w.name;
+  }
+  if (!known || args.threads == 0 || args.duration <= 0 || ns.empty()
+      || any_of(ns.begin(), ns.end(), [](unsigned n) { return n == 0 || n > _MAX_PROCESSES; })) {
+    show_usage();
+    return -1;
+  }
+
+  for (unsigned n : ns) {
+    run_count(n, args, kill_every);
+  }
+  return 0;
+}